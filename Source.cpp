@@ -1,16 +1,22 @@
 #include <stdio.h>
+#include <string>
 
 #include "src/Compiler.h"
 
 int main(int argc, char* argv[])
 {
 	Compiler compiler;
-	if (argc <= 1)
+	std::string path = "test.txt";
+	for (int i = 1; i < argc; i++)
 	{
-		compiler.compile("test.txt");
-		return 0;
+		std::string arg = argv[i];
+		if (arg == "--register-calls")
+		{
+			compiler.use_register_calls(true);
+			continue;
+		}
+		path = arg;
 	}
-	char* arg = argv[1];
-	compiler.compile(arg);
+	compiler.compile(path);
 	return 0;
-}
\ No newline at end of file
+}
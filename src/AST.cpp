@@ -1,3 +1,5 @@
+#include <cctype>
+
 #include "AST.h"
 
 std::vector<std::shared_ptr<Expr>> Expr::clone_vec(const std::vector<std::shared_ptr<Expr>>& exprs)
@@ -20,4 +22,70 @@ std::vector<std::unique_ptr<Stmt>> Stmt::clone_vec(const std::vector<std::unique
 		cloned.push_back(val->clone());
 	}
 	return cloned;
-}
\ No newline at end of file
+}
+
+static bool acceptable_variable_character(char character)
+{
+	return std::isalnum(character) || character == '&';
+}
+
+// start and length of every variable reference, including the $ and &
+static std::vector<std::pair<size_t, size_t>> variable_references(const std::string& in)
+{
+	std::vector<std::pair<size_t, size_t>> result;
+	for (size_t i = 0; i < in.size(); ++i)
+	{
+		// if current is $ and prev was whitespace
+		if (in[i] == '$' && (i == 0 || !acceptable_variable_character(in[i - 1])))
+		{
+			size_t j = i + 1;
+			while (j < in.size() && acceptable_variable_character(in[j]))
+			{
+				++j;
+			}
+			if (j > i + 1 && (j == in.size() || !acceptable_variable_character(in[j])))
+			{
+				result.push_back({ i, j - i });
+				i = j - 1;
+			}
+		}
+	}
+	return result;
+}
+
+std::vector<std::string> Stmt::Asm::referenced_variables() const
+{
+	std::vector<std::string> result;
+	const Expr::Literal* str = dynamic_cast<const Expr::Literal*>(this->literal.get());
+	if (!str || !str->literal.literal.is_string())
+	{
+		return result;
+	}
+	const std::string& in = *str->literal.literal.string;
+	for (const auto& reference : variable_references(in))
+	{
+		result.push_back(in.substr(reference.first, reference.second));
+	}
+	return result;
+}
+
+void Stmt::Asm::rename_variables(const std::function<std::string(const std::string&)>& rename)
+{
+	Expr::Literal* str = dynamic_cast<Expr::Literal*>(this->literal.get());
+	if (!str || !str->literal.literal.is_string())
+	{
+		return;
+	}
+	std::string& in = *str->literal.literal.string;
+	std::string out;
+	size_t copied = 0;
+	for (const auto& reference : variable_references(in))
+	{
+		size_t prefix = reference.second > 1 && in[reference.first + 1] == '&' ? 2 : 1;
+		out += in.substr(copied, reference.first + prefix - copied);
+		out += rename(in.substr(reference.first + prefix, reference.second - prefix));
+		copied = reference.first + reference.second;
+	}
+	out += in.substr(copied);
+	in = std::move(out);
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -20,6 +21,7 @@ struct Expr
 	struct Call;
 	struct Logical;
 	struct DeviceLoad;
+	struct Select;
 	class Visitor;
 
 	template <typename T>
@@ -53,6 +55,7 @@ public:
 	virtual void* visitExprCall(Expr::Call& expr) { return nullptr; }
 	virtual void* visitExprLogical(Expr::Logical& expr) { return nullptr; }
 	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) { return nullptr; }
+	virtual void* visitExprSelect(Expr::Select& expr) { return nullptr; }
 private:
 };
 
@@ -92,6 +95,7 @@ struct Stmt
 	Stmt& operator=(const Stmt&) = delete;
 	Stmt(Stmt&&) = default;
 	Stmt& operator=(Stmt&&) = default;
+	virtual ~Stmt() = default;
 
 	template <typename T>
 	bool is();
@@ -148,6 +152,8 @@ struct Stmt::Variable : public Stmt
 	TypeName type;
 	Token name;
 	std::shared_ptr<Expr> initalizer;
+	// set by the frame layout of the function right before code generation
+	int slot = -1;
 	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Variable>(this->type, this->name, this->initalizer->clone()); }
 	NODE_VISIT_IMPL(Stmt, Variable)
 };
@@ -167,8 +173,11 @@ struct Stmt::DeviceSet : public Stmt
 struct Stmt::Static : public Stmt
 {
 	Static(std::unique_ptr<Stmt> var) :var(std::move(var)) {};
+	Static(std::unique_ptr<Stmt> var, bool in_register) :var(std::move(var)), in_register(in_register) {};
 	std::unique_ptr<Stmt> var;
-	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Static>(this->var->clone()); }
+	// set by static promotion when the static is kept in a register of its own for the whole program
+	bool in_register = false;
+	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Static>(this->var->clone(), this->in_register); }
 	NODE_VISIT_IMPL(Stmt, Static)
 };
 
@@ -177,7 +186,9 @@ struct Stmt::Return : public Stmt
 	Return(const Token& keyword, std::shared_ptr<Expr> value) :keyword(keyword), value(value) {};
 	Token keyword;
 	std::shared_ptr<Expr> value;
-	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Return>(this->keyword, this->value->clone()); }
+	// set by the optimizer when the value is a call whose result is returned as is
+	bool tail_call = false;
+	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Return>(this->keyword, this->value ? this->value->clone() : nullptr); }
 	NODE_VISIT_IMPL(Stmt, Return)
 };
 
@@ -220,7 +231,7 @@ struct Stmt::If : public Stmt
 	std::unique_ptr<Stmt> branch_true;
 	std::unique_ptr<Stmt> branch_false;
 	Token token;
-	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::If>(this->token, this->condition->clone(), this->branch_true->clone(), this->branch_false->clone()); }
+	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::If>(this->token, this->condition->clone(), this->branch_true->clone(), this->branch_false ? this->branch_false->clone() : nullptr); }
 	NODE_VISIT_IMPL(Stmt, If)
 };
 
@@ -254,6 +265,10 @@ struct Stmt::Asm : public Stmt
 	Asm(std::shared_ptr<Expr> literal, Token token) :literal(literal), token(token) {};
 	std::shared_ptr<Expr> literal;
 	Token token;
+	// every variable reference as written in the asm, $name for reads and $&name for writes
+	std::vector<std::string> referenced_variables() const;
+	// rewrites the name of every reference, rename is given the name without the $ or $&
+	void rename_variables(const std::function<std::string(const std::string&)>& rename);
 	virtual std::unique_ptr<Stmt> clone() const override { return std::make_unique<Stmt::Asm>(this->literal->clone(), this->token); }
 	NODE_VISIT_IMPL(Stmt, Asm)
 };
@@ -265,7 +280,14 @@ struct Expr::DeviceLoad : public Expr
 	std::shared_ptr<Expr> device;
 	Token logic_type;
 	TypeName operation_type;
-	virtual std::shared_ptr<Expr> clone() const override { return std::make_shared<Expr::DeviceLoad>(this->device->clone(), this->logic_type, this->operation_type); }
+	// written as dload stable, promising the value does not change while the program runs
+	bool stable = false;
+	virtual std::shared_ptr<Expr> clone() const override
+	{
+		std::shared_ptr<Expr::DeviceLoad> load = std::make_shared<Expr::DeviceLoad>(this->device->clone(), this->logic_type, this->operation_type);
+		load->stable = this->stable;
+		return load;
+	}
 	NODE_VISIT_IMPL(Expr, DeviceLoad)
 };
 
@@ -279,6 +301,19 @@ struct Expr::Logical : public Expr
 	NODE_VISIT_IMPL(Expr, Logical)
 };
 
+// Evaluates both values and picks one by the condition, only created by the optimizer.
+struct Expr::Select : public Expr
+{
+	Select(const Token& token, std::shared_ptr<Expr> condition, std::shared_ptr<Expr> if_true, std::shared_ptr<Expr> if_false)
+		:token(token), condition(condition), if_true(if_true), if_false(if_false), Expr(UNDEFINED_TYPE) {};
+	Token token;
+	std::shared_ptr<Expr> condition;
+	std::shared_ptr<Expr> if_true;
+	std::shared_ptr<Expr> if_false;
+	virtual std::shared_ptr<Expr> clone() const override { return std::make_shared<Expr::Select>(this->token, this->condition->clone(), this->if_true->clone(), this->if_false->clone()); }
+	NODE_VISIT_IMPL(Expr, Select)
+};
+
 struct Expr::Call : public Expr
 {
 	Call(std::shared_ptr<Expr> callee, const Token& paren, std::vector<std::shared_ptr<Expr>> arguments) :callee(callee), paren(paren), arguments(arguments),
@@ -294,6 +329,8 @@ struct Expr::Variable : public Expr
 {
 	Variable(const Token& name) :name(name), Expr(UNDEFINED_TYPE) {};
 	Token name;
+	// set by the frame layout of the function right before code generation
+	int slot = -1;
 	virtual std::shared_ptr<Expr> clone() const override { return std::make_shared<Expr::Variable>(this->name); }
 	NODE_VISIT_IMPL(Expr, Variable)
 };
@@ -303,6 +340,8 @@ struct Expr::Assignment : public Expr
 	Assignment(const Token& name, std::shared_ptr<Expr> value) :name(name), value(value), Expr(UNDEFINED_TYPE) {};
 	std::shared_ptr<Expr> value;
 	Token name;
+	// set by the frame layout of the function right before code generation
+	int slot = -1;
 	virtual std::shared_ptr<Expr> clone() const override { return std::make_shared<Expr::Assignment>(this->name, this->value->clone()); }
 	NODE_VISIT_IMPL(Expr, Assignment)
 };
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <sstream>
+
+#include "CallGraph.h"
+
+CallGraph::CallGraph(std::vector<std::unique_ptr<Stmt>>& statements)
+	:current(nullptr)
+{
+	for (auto& stmt : statements)
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			Stmt::Function& function = stmt->as<Stmt::Function>();
+			this->functions.emplace(function.name.lexeme, &function);
+			this->calls[&function];
+		}
+	}
+	for (auto& entry : this->functions)
+	{
+		this->current = entry.second;
+		for (auto& stmt : entry.second->body)
+		{
+			stmt->accept(*this);
+		}
+	}
+	// calls made while initializing statics are kept under no function
+	this->current = nullptr;
+	this->calls[nullptr];
+	for (auto& stmt : statements)
+	{
+		if (stmt->is<Stmt::Static>())
+		{
+			stmt->accept(*this);
+		}
+	}
+}
+
+Stmt::Function* CallGraph::function(const std::string& name) const
+{
+	const auto& found = this->functions.find(name);
+	if (found == this->functions.end())
+	{
+		return nullptr;
+	}
+	return found->second;
+}
+
+const std::vector<Stmt::Function*>& CallGraph::callees(const Stmt::Function& function) const
+{
+	return this->calls.at(&function);
+}
+
+std::unordered_set<const Stmt::Function*> CallGraph::reachable(const Stmt::Function& entry) const
+{
+	std::unordered_set<const Stmt::Function*> visited;
+	std::vector<const Stmt::Function*> pending = { &entry };
+	for (const Stmt::Function* callee : this->calls.at(nullptr))
+	{
+		pending.push_back(callee);
+	}
+	while (pending.size())
+	{
+		const Stmt::Function* next = pending.back();
+		pending.pop_back();
+		if (!visited.insert(next).second)
+		{
+			continue;
+		}
+		for (const Stmt::Function* callee : this->callees(*next))
+		{
+			pending.push_back(callee);
+		}
+	}
+	return visited;
+}
+
+bool CallGraph::is_leaf(const Stmt::Function& function) const
+{
+	return this->callees(function).empty() && !this->uses_ra.count(&function);
+}
+
+bool CallGraph::is_recursive(const Stmt::Function& function) const
+{
+	std::vector<const Stmt::Function*> pending = { &function };
+	std::unordered_set<const Stmt::Function*> seen;
+	while (pending.size())
+	{
+		const Stmt::Function* next = pending.back();
+		pending.pop_back();
+		for (const Stmt::Function* callee : this->callees(*next))
+		{
+			if (callee == &function)
+			{
+				return true;
+			}
+			if (seen.insert(callee).second)
+			{
+				pending.push_back(callee);
+			}
+		}
+	}
+	return false;
+}
+
+bool CallGraph::is_pure(const Stmt::Function& function) const
+{
+	std::unordered_set<const Stmt::Function*> visited;
+	std::vector<const Stmt::Function*> pending = { &function };
+	while (pending.size())
+	{
+		const Stmt::Function* next = pending.back();
+		pending.pop_back();
+		if (!visited.insert(next).second)
+		{
+			continue;
+		}
+		if (this->has_effects.count(next))
+		{
+			return false;
+		}
+		for (const Stmt::Function* callee : this->callees(*next))
+		{
+			pending.push_back(callee);
+		}
+	}
+	return true;
+}
+
+void* CallGraph::visitExprBinary(Expr::Binary& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprGrouping(Expr::Grouping& expr)
+{
+	expr.expression->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprUnary(Expr::Unary& expr)
+{
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprAssignment(Expr::Assignment& expr)
+{
+	expr.value->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprCall(Expr::Call& expr)
+{
+	for (auto& arg : expr.arguments)
+	{
+		arg->accept(*this);
+	}
+	Stmt::Function* callee = expr.callee->is<Expr::Variable>() ? this->function(expr.callee->as<Expr::Variable>().name.lexeme) : nullptr;
+	if (!callee)
+	{
+		// not a known function, assume the worst
+		this->uses_ra.insert(this->current);
+		this->has_effects.insert(this->current);
+		return nullptr;
+	}
+	std::vector<Stmt::Function*>& callees = this->calls[this->current];
+	if (std::find(callees.begin(), callees.end(), callee) == callees.end())
+	{
+		callees.push_back(callee);
+	}
+	return nullptr;
+}
+
+void* CallGraph::visitExprLogical(Expr::Logical& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprSelect(Expr::Select& expr)
+{
+	expr.condition->accept(*this);
+	expr.if_true->accept(*this);
+	expr.if_false->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	this->has_effects.insert(this->current);
+	expr.device->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtExpression(Stmt::Expression& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtAsm(Stmt::Asm& stmt)
+{
+	this->has_effects.insert(this->current);
+	const Expr::Literal* str = dynamic_cast<const Expr::Literal*>(stmt.literal.get());
+	if (!str || !str->literal.literal.is_string())
+	{
+		return nullptr;
+	}
+	// jal and every other "and link" instruction ends in al and overwrites ra
+	std::istringstream lines(*str->literal.literal.string);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		std::istringstream words(line);
+		std::string word;
+		bool first = true;
+		while (words >> word)
+		{
+			bool links = first && word.size() >= 2 && word.compare(word.size() - 2, 2, "al") == 0;
+			if (links || word == "ra")
+			{
+				this->uses_ra.insert(this->current);
+				return nullptr;
+			}
+			first = false;
+		}
+	}
+	return nullptr;
+}
+
+void* CallGraph::visitStmtPrint(Stmt::Print& stmt)
+{
+	this->has_effects.insert(this->current);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtVariable(Stmt::Variable& stmt)
+{
+	stmt.initalizer->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtBlock(Stmt::Block& stmt)
+{
+	for (auto& statement : stmt.statements)
+	{
+		statement->accept(*this);
+	}
+	return nullptr;
+}
+
+void* CallGraph::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.branch_true->accept(*this);
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+	}
+	return nullptr;
+}
+
+void* CallGraph::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		stmt.value->accept(*this);
+	}
+	return nullptr;
+}
+
+void* CallGraph::visitStmtWhile(Stmt::While& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.body->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtStatic(Stmt::Static& stmt)
+{
+	this->has_effects.insert(this->current);
+	stmt.var->accept(*this);
+	return nullptr;
+}
+
+void* CallGraph::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	this->has_effects.insert(this->current);
+	stmt.device->accept(*this);
+	stmt.value->accept(*this);
+	return nullptr;
+}
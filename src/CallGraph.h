@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AST.h"
+
+// Which functions each top-level function calls, built from the AST.
+class CallGraph : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	explicit CallGraph(std::vector<std::unique_ptr<Stmt>>& statements);
+
+	Stmt::Function* function(const std::string& name) const;
+	const std::vector<Stmt::Function*>& callees(const Stmt::Function& function) const;
+	// every function that can run when the program starts at entry, including what initializes statics
+	std::unordered_set<const Stmt::Function*> reachable(const Stmt::Function& entry) const;
+	// calls nothing and never touches ra, so ra survives until it returns
+	bool is_leaf(const Stmt::Function& function) const;
+	// calls itself through some chain of calls, so its frame can be on the stack many times
+	bool is_recursive(const Stmt::Function& function) const;
+	// nothing it can reach runs asm, touches a device, prints or declares a static
+	// reading a static is not caught here, evaluating such a function fails instead
+	bool is_pure(const Stmt::Function& function) const;
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
+	virtual void* visitStmtPrint(Stmt::Print& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtStatic(Stmt::Static& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	std::unordered_map<std::string, Stmt::Function*> functions;
+	std::unordered_map<const Stmt::Function*, std::vector<Stmt::Function*>> calls;
+	std::unordered_set<const Stmt::Function*> uses_ra;
+	std::unordered_set<const Stmt::Function*> has_effects;
+	Stmt::Function* current;
+};
@@ -1,41 +1,30 @@
+#include <algorithm>
+#include <cstring>
+
 #include "CodeGenerator.h"
 #include "Compiler.h"
+#include "Peephole.h"
+#include "ExprUtil.h"
 
-std::unique_ptr<StackVariable> StackEnvironment::resolve(const std::string& name)
+const StackVariable* StackEnvironment::resolve(const std::string& name) const
 {
-	const auto& val = this->variables.find(name);
-	if (val != this->variables.end())
-	{
-		std::unique_ptr<StackVariable> var = std::make_unique<StackVariable>(this->variables.at(name));
-		if (var->is_static)
-		{
-			var->offset = -(var->offset + 1);
-		}
-		return var;
-	}
-	if (this->parent)
+	for (const StackEnvironment* env = this; env; env = env->parent)
 	{
-		std::unique_ptr<StackVariable> var = this->parent->resolve(name);
-		if (!var)
-		{
-			return nullptr;
-		}
-		if (var->is_static)
+		const auto& found = env->variables.find(name);
+		if (found != env->variables.end())
 		{
-			return var;
+			return &found->second;
 		}
-		var->offset += this->m_frame_size;
-		return var;
 	}
 	return nullptr;
 }
 
 StackEnvironment::StackEnvironment()
-	:m_frame_size(0), m_function_name(nullptr), parent(nullptr), child(nullptr)
+	:m_frame_size(0), m_base(0), m_function_name(nullptr), parent(nullptr), child(nullptr)
 {}
 
 StackEnvironment::StackEnvironment(StackEnvironment* parent)
-	:m_frame_size(0), m_function_name(nullptr), parent(parent), child(nullptr)
+	:m_frame_size(0), m_base(parent->depth()), m_function_name(nullptr), parent(parent), child(nullptr)
 {}
 
 StackEnvironment::~StackEnvironment()
@@ -78,38 +67,19 @@ const std::string& StackEnvironment::function_name() const
 
 void StackEnvironment::forget(const std::string& name)
 {
-	for (auto iterator = this->variables.begin(); iterator != this->variables.end(); iterator++)
+	if (!this->variable_list.size() || this->variable_list.back()->name != name)
 	{
-		if (iterator->first == name)
-		{
-			size_t id = iterator->second.id;
-			int size = iterator->second.size;
-			this->variables.erase(iterator);
-			for (size_t i = 0; i < id; i++)
-			{
-				this->variable_list[i]->offset -= size;
-			}
-			this->m_frame_size -= size;
-			this->variable_list.erase(this->variable_list.begin() + id);
-			for (size_t i = 0; i < this->variable_list.size(); i++)
-			{
-				this->variable_list[i]->id = i;
-			}
-			return;
-		}
+		throw std::logic_error(std::string("Attempted to forget a variable that was not the last one defined: ") + name);
 	}
-	throw std::logic_error(std::string("Attempted to forget a non-existent variable: ") + name);
+	this->m_frame_size -= this->variable_list.back()->size;
+	this->variable_list.pop_back();
+	this->variables.erase(name);
 }
 
 StackVariable& StackEnvironment::define(const std::string& name, int size)
 {
-	for (auto& var : this->variables)
-	{
-		var.second.offset += size;
-	}
-	this->variables.emplace(name, StackVariable(name, size));
-	StackVariable* var = &this->variables.at(name);
-	var->id = this->variable_list.size();
+	StackVariable* var = &this->variables.insert_or_assign(name, StackVariable(name, size)).first->second;
+	var->position = this->depth();
 	this->variable_list.push_back(var);
 	this->m_frame_size += size;
 	return *var;
@@ -122,9 +92,54 @@ StackVariable& StackEnvironment::define_static(const std::string& name, int size
 	return var;
 }
 
-void StackEnvironment::set_frame_size(int value)
+StackVariable& StackEnvironment::define_register(const std::string& name, int register_index)
+{
+	// takes no space in the frame
+	StackVariable& var = this->define(name, 0);
+	var.register_index = register_index;
+	return var;
+}
+
+StackVariable& StackEnvironment::define_in_slot(const std::string& name, int position)
+{
+	StackVariable* var = &this->variables.insert_or_assign(name, StackVariable(name, 0)).first->second;
+	var->position = position;
+	return *var;
+}
+
+void StackEnvironment::free_slot(int position)
+{
+	for (StackEnvironment* env = this; env; env = env->parent)
+	{
+		if (position >= env->m_base && position < env->depth())
+		{
+			env->free_positions.push_back(position);
+			return;
+		}
+		if (env->m_function_name)
+		{
+			return;
+		}
+	}
+}
+
+int StackEnvironment::take_free_slot()
 {
-	this->m_frame_size = value;
+	for (StackEnvironment* env = this; env; env = env->parent)
+	{
+		if (env->free_positions.size())
+		{
+			auto nearest = std::max_element(env->free_positions.begin(), env->free_positions.end());
+			int position = *nearest;
+			env->free_positions.erase(nearest);
+			return position;
+		}
+		if (env->m_function_name)
+		{
+			break;
+		}
+	}
+	return -1;
 }
 
 int StackEnvironment::frame_size() const
@@ -132,9 +147,9 @@ int StackEnvironment::frame_size() const
 	return this->m_frame_size;
 }
 
-const std::vector<StackVariable*>& StackEnvironment::see_variables() const
+int StackEnvironment::depth() const
 {
-	return this->variable_list;
+	return this->m_base + this->m_frame_size;
 }
 
 StackEnvironment* StackEnvironment::spawn()
@@ -152,6 +167,8 @@ StackEnvironment* StackEnvironment::spawn_in_function(const std::string& name)
 	}
 	StackEnvironment* child = new StackEnvironment(this);
 	this->child = child;
+	// a function starts a frame of its own
+	child->m_base = 0;
 	child->m_function_name = std::make_unique<std::string>(name);
 	return child;
 }
@@ -194,6 +211,9 @@ StackEnvironment& StackEnvironment::operator=(StackEnvironment&& other) noexcept
 	if (this != &other)
 	{
 		this->m_frame_size = other.m_frame_size;
+		this->m_base = other.m_base;
+		this->free_positions = std::move(other.free_positions);
+		this->variable_list = std::move(other.variable_list);
 		this->parent = std::move(other.parent);
 		this->child = std::move(other.child);
 		this->variables = std::move(other.variables);
@@ -202,43 +222,70 @@ StackEnvironment& StackEnvironment::operator=(StackEnvironment&& other) noexcept
 	return *this;
 }
 
-Register::Register(RegisterHandle handle)
-	:register_handle(handle)
-{}
+Register::Register(RegisterAllocator& allocator, int index)
+	:allocator(&allocator), m_index(index)
+{
+	this->allocator->hold(index);
+}
 
 Register::~Register()
-{}
-
-Register::Register(const Register& other)
-	:register_handle(other.register_handle)
-{}
+{
+	this->release();
+}
 
 Register::Register(Register&& other) noexcept
-	:register_handle(std::move(other.register_handle))
-{}
+	:allocator(other.allocator), m_index(other.m_index)
+{
+	other.allocator = nullptr;
+}
 
-std::string Register::to_string() const
+Register& Register::operator=(Register&& other) noexcept
 {
-	return std::string("r") + std::to_string(this->index());
+	if (this != &other)
+	{
+		this->release();
+		this->allocator = other.allocator;
+		this->m_index = other.m_index;
+		other.allocator = nullptr;
+	}
+	return *this;
+}
+
+void Register::release()
+{
+	if (this->allocator)
+	{
+		this->allocator->release(this->m_index);
+		this->allocator = nullptr;
+	}
 }
 
-RegisterHandle Register::handle()
+Register Register::share() const
 {
-	return this->register_handle;
+	if (!this->allocator)
+	{
+		throw std::logic_error("Attempted to share a register that was moved from.");
+	}
+	return Register(*this->allocator, this->m_index);
 }
 
-RegisterHandle* Register::release()
+std::string Register::to_string() const
 {
-	return new RegisterHandle(std::move(this->register_handle));
+	return std::string("r") + std::to_string(this->index());
 }
 
 int Register::index() const
 {
-	return *this->register_handle;
+	return this->m_index;
 }
 
-RegisterOrLiteral::RegisterOrLiteral(const Register& reg)
-	:m_reg(std::make_unique<Register>(reg)), m_literal(nullptr)
+bool Register::is_shared() const
+{
+	return this->allocator && this->allocator->holds[this->m_index] > 1;
+}
+
+RegisterOrLiteral::RegisterOrLiteral(Register reg)
+	:m_reg(std::make_unique<Register>(std::move(reg))), m_literal(nullptr)
 {}
 
 RegisterOrLiteral::RegisterOrLiteral(const Literal& literal)
@@ -298,6 +345,20 @@ const Literal& RegisterOrLiteral::get_literal() const
 	return *this->m_literal;
 }
 
+void RegisterOrLiteral::spill()
+{
+	if (!this->is_register())
+	{
+		throw std::logic_error("Attempted to spill while this was not a register.");
+	}
+	this->m_reg = nullptr;
+}
+
+void RegisterOrLiteral::reload(Register reg)
+{
+	this->m_reg = std::make_unique<Register>(std::move(reg));
+}
+
 std::string RegisterOrLiteral::to_string() const
 {
 	if (this->is_literal())
@@ -317,27 +378,40 @@ RegisterOrLiteral::~RegisterOrLiteral()
 }
 
 RegisterAllocator::RegisterAllocator(size_t register_count)
+	:m_register_count(register_count), holds(), m_high_water_mark(0)
 {
-	this->registers.reserve(register_count);
-	for (int i = 0; i < register_count; i++)
+	if (register_count > max_registers)
 	{
-		this->registers.push_back(std::make_shared<int>(i));
+		throw std::out_of_range(std::string("Attempted to create an allocator for ") + std::to_string(register_count) + " registers, at most " + std::to_string(max_registers) + " are supported.");
 	}
 }
 
-RegisterAllocator::~RegisterAllocator()
-{}
+void RegisterAllocator::hold(int index)
+{
+	if (!this->holds[index]++)
+	{
+		this->in_use.set(index);
+		this->m_high_water_mark = std::max(this->m_high_water_mark, this->in_use.count());
+	}
+}
+
+void RegisterAllocator::release(int index)
+{
+	if (!--this->holds[index])
+	{
+		this->in_use.reset(index);
+	}
+}
 
-std::vector<Register> RegisterAllocator::registers_in_use() const
+std::vector<Register> RegisterAllocator::registers_in_use()
 {
 	std::vector<Register> used_registers;
-	used_registers.reserve(this->registers.size());
-	for (size_t i = 0; i < this->registers.size(); i++)
+	used_registers.reserve(this->in_use.count());
+	for (size_t i = 0; i < this->m_register_count; i++)
 	{
-		const auto& reg = this->registers[i];
-		if (reg.use_count() > 1)
+		if (this->in_use.test(i))
 		{
-			used_registers.push_back(Register(reg));
+			used_registers.push_back(Register(*this, static_cast<int>(i)));
 		}
 	}
 	return used_registers;
@@ -345,33 +419,56 @@ std::vector<Register> RegisterAllocator::registers_in_use() const
 
 Register RegisterAllocator::allocate()
 {
-	for (size_t i = 0; i < this->registers.size(); i++)
+	for (size_t i = 0; i < this->m_register_count; i++)
 	{
-		const auto& reg = this->registers[i];
-		if (reg.use_count() == 1)
+		if (!this->in_use.test(i))
 		{
-			return Register(reg);
+			return Register(*this, static_cast<int>(i));
 		}
 	}
 	throw std::runtime_error("Register allocation failed. No available registers.");
 }
 
+Register RegisterAllocator::allocate(size_t id)
+{
+	if (this->is_register_in_use(id))
+	{
+		throw std::logic_error(std::string("Attempted to allocate register ") + std::to_string(id) + " while it was in use.");
+	}
+	return Register(*this, static_cast<int>(id));
+}
+
+bool RegisterAllocator::has_free_register() const
+{
+	return this->in_use.count() < this->m_register_count;
+}
+
 size_t RegisterAllocator::register_count() const
 {
-	return this->registers.size();
+	return this->m_register_count;
 }
 
 bool RegisterAllocator::is_register_in_use(size_t id) const
 {
-	if (id >= this->registers.size())
+	if (id >= this->m_register_count)
 	{
 		throw std::out_of_range(std::string("Attempted to get register ") + std::to_string(id) + " which is out of range (0-" + std::to_string(this->register_count() - 1));
 	}
-	return this->registers.at(id).use_count() > 1;
+	return this->in_use.test(id);
+}
+
+size_t RegisterAllocator::high_water_mark() const
+{
+	return this->m_high_water_mark;
+}
+
+void RegisterAllocator::reset_high_water_mark()
+{
+	this->m_high_water_mark = this->in_use.count();
 }
 
-CodeGenerator::CodeGenerator(Compiler& compiler, TypeCheckedProgram& program)
-	:compiler(compiler), m_program(program), allocator(16), top_env(), env(nullptr), current_placeholder_value(0)
+CodeGenerator::CodeGenerator(Compiler& compiler, TypeCheckedProgram& program, CallingConvention convention)
+	:allocator(16), convention(convention), env(nullptr), top_env(), source_line(0), compiler(compiler), m_program(program)
 {
 	this->env = &top_env;
 }
@@ -397,38 +494,42 @@ void CodeGenerator::pop_env()
 	this->env = this->env->pop();
 }
 
-static void find_and_replace_in(std::string& str, const std::string& replace, const std::string& with)
-{
-	size_t found = 0;
-	while ((found = str.find(replace, found)) != std::string::npos)
-	{
-		str.replace(found, replace.length(), with);
-		found += with.length();
-	}
-}
-
 std::string CodeGenerator::generate()
 {
 	try
 	{
+		this->call_graph = std::make_unique<CallGraph>(this->m_program.statements());
 		this->pass = Pass::GlobalLinkage;
 		for (auto& stmt : this->m_program.statements())
 		{
 			this->visit_stmt(stmt);
 		}
-		
-		this->emit_raw("jal ");
-		this->emit_raw(this->m_program.env().root()->get_variable(Identifier("main"))->full_type().mangled_name());
-		this->emit_raw("\n");
 
-		this->emit_raw("sub sp sp 1\n");
-		this->emit_raw("jr -2\n");
+		LabelId entry = this->create_label();
+		this->place_label(entry);
+		this->emit(Opcode::JumpAndLink, { Operand::label(this->buffer.named_label(this->m_program.env().root()->get_variable(Identifier("main"))->full_type().mangled_name())) });
+		if (this->convention == CallingConvention::Stack)
+		{
+			// discard main's return value
+			this->emit(Opcode::Sub, { Operand::reg(registers::sp), Operand::reg(registers::sp), Operand::number(1) });
+		}
+		this->emit(Opcode::JumpRelative, { Operand::label(entry) });
 
 		this->pass = Pass::FunctionLinkage;
 		for (auto& stmt : this->m_program.statements())
 		{
 			this->visit_stmt(stmt);
 		}
+
+		std::vector<int> globals;
+		for (const auto& held : this->static_registers)
+		{
+			globals.push_back(held.first);
+		}
+		Peephole peephole(this->compiler, this->buffer, this->convention == CallingConvention::Registers ? 0 : -1, globals);
+		int removed = peephole.run();
+		this->compiler.info(std::string("Peephole pass removed ") + std::to_string(removed) + " lines.");
+		return this->buffer.serialize();
 	}
 	catch (std::exception& e)
 	{
@@ -437,64 +538,156 @@ std::string CodeGenerator::generate()
 	catch(CodeGenerationError&)
 	{
 		this->compiler.error(-1, "Error detected, aborting code generation.");
-		return "";
 	}
-	size_t found = 0;
-	while ((found = this->code.find("\n@function", found)) != std::string::npos)
+	return "";
+}
+
+const InstructionBuffer& CodeGenerator::instructions() const
+{
+	return this->buffer;
+}
+
+Operand CodeGenerator::operand(const Register& reg)
+{
+	return Operand::reg(reg.index());
+}
+
+Operand CodeGenerator::operand(const RegisterOrLiteral& value)
+{
+	if (value.is_register())
+	{
+		return CodeGenerator::operand(value.get_register());
+	}
+	return Operand::literal(value.get_literal());
+}
+
+Operand CodeGenerator::device_operand(const RegisterOrLiteral& device, const Token& token)
+{
+	if (device.is_register())
+	{
+		return Operand::device_register(device.get_register().index());
+	}
+	int device_id = device.get_literal().as_integer();
+	if (device_id > 5 || device_id < -1)
 	{
-		found = found + 1;
-		size_t end = this->code.find(':', found);
-		std::string identifier = this->code.substr(found, end - found);
-		this->code.erase(found, end - found + 1);
-		int64_t line = std::count(this->code.begin(), this->code.begin() + found, '\n');
-		find_and_replace_in(this->code, identifier, std::to_string(line));
+		this->error(token, std::string("Attempted to use device d") + std::to_string(device_id) + " which is out of range for dx {-1 <= x <= 5}.");
 	}
-	return std::move(this->code);
+	return Operand::device(device_id);
+}
+
+void CodeGenerator::emit(Opcode opcode, std::vector<Operand> operands)
+{
+	this->buffer.emit(Instruction(opcode, std::move(operands), this->source_line));
 }
 
 void CodeGenerator::emit_raw(const std::string& val)
 {
-	this->code += val;
+	// one instruction per line, so multi-line asm is split up
+	size_t start = 0;
+	size_t end = 0;
+	while ((end = val.find('\n', start)) != std::string::npos)
+	{
+		this->buffer.emit(Instruction(Opcode::Raw, val.substr(start, end - start), this->source_line));
+		start = end + 1;
+	}
+	this->buffer.emit(Instruction(Opcode::Raw, val.substr(start), this->source_line));
 }
 
-void CodeGenerator::emit_register_use(const Register& reg)
+LabelId CodeGenerator::create_label()
 {
-	this->emit_raw(reg.to_string());
+	return this->buffer.create_label();
 }
 
-void CodeGenerator::emit_register_use(const Register& a, const Register& b)
+void CodeGenerator::place_label(LabelId label)
 {
-	this->emit_register_use(a);
-	this->emit_raw(" ");
-	this->emit_register_use(b);
+	this->buffer.place_label(label, this->source_line);
 }
 
 void CodeGenerator::emit_peek_stack_from_into(Register* reg)
 {
 	Register prev_stack_ptr = this->allocator.allocate();
-	this->emit_raw("move ");
-	this->emit_register_use(prev_stack_ptr);
-	this->emit_raw(" sp");
-	this->emit_raw("\n");
-
-	this->emit_raw("move sp ");
-	this->emit_register_use(*reg);
-	this->emit_raw("\n");
-	
-	this->emit_raw("add sp sp 1\n");
-	
-	this->emit_raw("peek ");
-	this->emit_register_use(*reg);
-	this->emit_raw("\n");
-
-	this->emit_raw("move sp ");
-	this->emit_register_use(prev_stack_ptr);
-	this->emit_raw("\n");
+	this->emit(Opcode::Move, { this->operand(prev_stack_ptr), Operand::reg(registers::sp) });
+	this->emit(Opcode::Move, { Operand::reg(registers::sp), this->operand(*reg) });
+	this->emit(Opcode::Add, { Operand::reg(registers::sp), Operand::reg(registers::sp), Operand::number(1) });
+	this->emit(Opcode::Peek, { this->operand(*reg) });
+	this->emit(Opcode::Move, { Operand::reg(registers::sp), this->operand(prev_stack_ptr) });
 }
 
 std::unique_ptr<RegisterOrLiteral> CodeGenerator::visit_expr_raw(std::shared_ptr<Expr> expr)
 {
-	return std::unique_ptr<RegisterOrLiteral>(static_cast<RegisterOrLiteral*>(expr->accept(*this)));
+	std::unique_ptr<RegisterOrLiteral> value(static_cast<RegisterOrLiteral*>(expr->accept(*this)));
+	this->release_variable_registers(expr.get());
+	return value;
+}
+
+Register CodeGenerator::bind_variable_register(SymbolTable::Index symbol, int index, const RegisterOrLiteral& value)
+{
+	// whatever held it before is dead, its interval ended before this one started
+	this->variable_registers.erase(index);
+	if (value.is_register() && value.get_register().index() == index)
+	{
+		this->variable_registers.emplace(index, VariableRegister{ symbol, value.get_register().share() });
+		return value.get_register().share();
+	}
+	Register reg = this->allocator.allocate(index);
+	this->emit(Opcode::Move, { this->operand(reg), this->operand(value) });
+	this->variable_registers.emplace(index, VariableRegister{ symbol, reg.share() });
+	return reg;
+}
+
+void CodeGenerator::release_variable_registers(const void* node)
+{
+	if (!this->locals)
+	{
+		return;
+	}
+	if (this->deferred_releases)
+	{
+		this->deferred_releases->push_back(node);
+		return;
+	}
+	const std::vector<SymbolTable::Index>* ending = this->locals->ending_at(node);
+	if (!ending)
+	{
+		return;
+	}
+	for (SymbolTable::Index symbol : *ending)
+	{
+		if (this->share_slots)
+		{
+			this->free_stack_slot(symbol);
+		}
+		const auto& found = this->variable_registers.find(this->locals->register_of(symbol));
+		if (found != this->variable_registers.end() && found->second.symbol == symbol)
+		{
+			this->variable_registers.erase(found);
+		}
+	}
+}
+
+bool CodeGenerator::is_variable_register(const Register& reg) const
+{
+	return this->variable_registers.count(reg.index()) || this->is_static_register(reg.index());
+}
+
+bool CodeGenerator::is_static_register(int index) const
+{
+	return this->static_registers.count(index);
+}
+
+Register CodeGenerator::get_variable_register(const StackVariable& var)
+{
+	const auto& found = this->variable_registers.find(var.register_index);
+	if (found == this->variable_registers.end())
+	{
+		const auto& held = this->static_registers.find(var.register_index);
+		if (held != this->static_registers.end())
+		{
+			return held->second.share();
+		}
+		throw std::logic_error(std::string("Variable ") + var.name + " was used after its register was released.");
+	}
+	return found->second.reg.share();
 }
 
 std::unique_ptr<RegisterOrLiteral> CodeGenerator::visit_expr(std::shared_ptr<Expr> expr)
@@ -509,58 +702,52 @@ std::unique_ptr<RegisterOrLiteral> CodeGenerator::visit_expr(std::shared_ptr<Exp
 
 void* CodeGenerator::visitExprBinary(Expr::Binary& expr)
 {
-	std::unique_ptr<RegisterOrLiteral> left_temporary_handle = this->visit_expr_raw(expr.left);
-	std::unique_ptr<RegisterOrLiteral> right_temporary_handle = this->visit_expr_raw(expr.right);
-	if (!left_temporary_handle || !right_temporary_handle)
-	{
-		throw std::runtime_error("Binary operation requires two values.");
-	}
+	std::unique_ptr<RegisterOrLiteral> left_temporary_handle;
+	std::unique_ptr<RegisterOrLiteral> right_temporary_handle;
+	this->evaluate_operands(expr.left, expr.right, left_temporary_handle, right_temporary_handle);
+	this->source_line = expr.op.line;
 	RegisterOrLiteral& left_temporary = *left_temporary_handle;
 	RegisterOrLiteral& right_temporary = *right_temporary_handle;
 	Register output = this->get_or_make_output_register(left_temporary, right_temporary);
+	Opcode opcode;
 	switch (expr.op.type)
 	{
 	case TokenType::PLUS:
-		this->emit_raw("add ");
+		opcode = Opcode::Add;
 		break;
 	case TokenType::MINUS:
-		this->emit_raw("sub ");
+		opcode = Opcode::Sub;
 		break;
 	case TokenType::STAR:
-		this->emit_raw("mul ");
+		opcode = Opcode::Mul;
 		break;
 	case TokenType::SLASH:
-		this->emit_raw("div ");
+		opcode = Opcode::Div;
 		break;
 	case TokenType::GREATER:
-		this->emit_raw("sgt ");
+		opcode = Opcode::Sgt;
 		break;
 	case TokenType::LESS:
-		this->emit_raw("slt ");
+		opcode = Opcode::Slt;
 		break;
 	case TokenType::GREATER_EQUAL:
-		this->emit_raw("sge ");
+		opcode = Opcode::Sge;
 		break;
 	case TokenType::LESS_EQUAL:
-		this->emit_raw("sle ");
+		opcode = Opcode::Sle;
 		break;
 	case TokenType::EQUAL_EQUAL:
-		this->emit_raw("seq ");
+		opcode = Opcode::Seq;
 		break;
 	case TokenType::BANG_EQUAL:
-		this->emit_raw("sne ");
+		opcode = Opcode::Sne;
 		break;
 	default:
 		throw std::runtime_error("Binary operation had invalid type.");
 	}
 	// store result in left temporary
-	this->emit_register_use(output);
-	this->emit_raw(" ");
-	this->emit_raw(left_temporary.to_string());
-	this->emit_raw(" ");
-	this->emit_raw(right_temporary.to_string());
-	this->emit_raw("\n");
-	return new RegisterOrLiteral(output);
+	this->emit(opcode, { this->operand(output), this->operand(left_temporary), this->operand(right_temporary) });
+	return new RegisterOrLiteral(std::move(output));
 }
 
 void* CodeGenerator::visitExprGrouping(Expr::Grouping& expr)
@@ -577,28 +764,34 @@ void* CodeGenerator::visitExprUnary(Expr::Unary& expr)
 {
 	std::unique_ptr<RegisterOrLiteral> handle = this->visit_expr(expr.right);
 	RegisterOrLiteral& reg = *handle;
+	this->source_line = expr.op.line;
 	switch (expr.op.type)
 	{
 	case TokenType::BANG:
+	{
 		if (reg.is_literal())
 		{
-			return new RegisterOrLiteral(Literal(!reg.get_literal().as_boolean()));
+			const Literal& literal = reg.get_literal();
+			if (literal.is_number())
+			{
+				return new RegisterOrLiteral(Literal(literal.as_number() == 0 ? 1.0 : 0.0));
+			}
+			return new RegisterOrLiteral(Literal(!literal.as_boolean()));
 		}
-		this->emit_raw("seqz ");
-		this->emit_register_use(reg.get_register(), reg.get_register());
-		this->emit_raw("\n");
-		return handle.release();
+		Register output = this->get_or_make_output_register(reg, reg);
+		this->emit(Opcode::Seqz, { this->operand(output), this->operand(reg) });
+		return new RegisterOrLiteral(std::move(output));
+	}
 	case TokenType::MINUS:
+	{
 		if (reg.is_literal())
 		{
 			return new RegisterOrLiteral(Literal(-reg.get_literal().as_number()));
 		}
-		this->emit_raw("sub ");
-		this->emit_raw(reg.to_string());
-		this->emit_raw(" 0 ");
-		this->emit_raw(reg.to_string());
-		this->emit_raw("\n");
-		return handle.release();
+		Register output = this->get_or_make_output_register(reg, reg);
+		this->emit(Opcode::Sub, { this->operand(output), Operand::number(0), this->operand(reg) });
+		return new RegisterOrLiteral(std::move(output));
+	}
 	case TokenType::AMPERSAND:
 		if (!expr.right->is<Expr::Variable>())
 		{
@@ -616,147 +809,137 @@ void* CodeGenerator::visitExprUnary(Expr::Unary& expr)
 	throw std::runtime_error("Return missed while generating unary operation.");
 }
 
+const StackVariable& CodeGenerator::variable(int slot, const Token& name) const
+{
+	const StackVariable* var = this->layout && slot != FrameLayout::NoSlot ? this->frame[slot] : this->env->resolve(name.lexeme);
+	if (!var)
+	{
+		throw std::runtime_error("Attempt to use undefined variable.");
+	}
+	return *var;
+}
+
+int CodeGenerator::offset_of(const StackVariable& var) const
+{
+	if (var.is_static)
+	{
+		return -(var.position + 1);
+	}
+	return this->env->depth() - var.position - 1;
+}
+
 std::string CodeGenerator::get_register_name(const Register& reg)
 {
 	return std::string("r") + std::to_string(reg.index());
 }
 
-void CodeGenerator::emit_load_into(int offset, const std::string& register_label)
+void CodeGenerator::emit_load_into(int offset, const Operand& destination)
 {
+	Operand sp = Operand::reg(registers::sp);
 	if (offset < 0)
 	{
 
-		Register sp = this->allocator.allocate();
-		this->emit_raw("move ");
-		this->emit_register_use(sp);
-		this->emit_raw(" sp\n");
+		Register saved_sp = this->allocator.allocate();
+		this->emit(Opcode::Move, { this->operand(saved_sp), sp });
 
-		// offsets are off-by-one
-		// -1 is actually 0
+		// statics are counted from the bottom of the stack, off by one
 		/*
-		static fixed number device = -1; # offset 3 -> -4 # push 0 peek 1
-		static number x = 42;            # offset 2 -> -3 # push 1 peek 2
-		static number y = 69;            # offset 1 -> -2 # push 2 peek 3
-		static number z = -42;           # offset 0 -> -1 # push 3 peek 4
+		static fixed number device = -1; # position 0 -> -1 # push 0 peek 1
+		static number x = 42;            # position 1 -> -2 # push 1 peek 2
+		static number y = 69;            # position 2 -> -3 # push 2 peek 3
+		static number z = -42;           # position 3 -> -4 # push 3 peek 4
 		*/
 
-		this->emit_raw("move sp ");
-		this->emit_raw(std::to_string(this->top_env.frame_size() + offset + 1));
-		this->emit_raw("\n");
-
-		this->emit_raw("peek ");
-		this->emit_raw(register_label);
-		this->emit_raw("\n");
-
-		this->emit_raw("move sp ");
-		this->emit_register_use(sp);
-		this->emit_raw("\n");
-
+		this->emit(Opcode::Move, { sp, Operand::number(-offset) });
+		this->emit(Opcode::Peek, { destination });
+		this->emit(Opcode::Move, { sp, this->operand(saved_sp) });
 		return;
 	}
 
 	if (offset == 0)
 	{
-		this->emit_raw("peek ");
-		this->emit_raw(register_label);
-		this->emit_raw("\n");
+		this->emit(Opcode::Peek, { destination });
 		return;
 	}
-	this->emit_raw("sub sp sp ");
-	this->emit_raw(std::to_string(offset));
-	this->emit_raw("\n");
-	this->emit_raw("peek ");
-	this->emit_raw(register_label);
-	this->emit_raw("\n");
-	this->emit_raw("add sp sp ");
-	this->emit_raw(std::to_string(offset));
-	this->emit_raw("\n");
+	this->emit(Opcode::Sub, { sp, sp, Operand::number(offset) });
+	this->emit(Opcode::Peek, { destination });
+	this->emit(Opcode::Add, { sp, sp, Operand::number(offset) });
 }
 
 void CodeGenerator::emit_load_into(int offset, Register* reg)
 {
-	this->emit_load_into(offset, this->get_register_name(*reg));
+	this->emit_load_into(offset, this->operand(*reg));
 }
 
 void CodeGenerator::emit_store_into(int offset, const RegisterOrLiteral& source)
 {
+	Operand sp = Operand::reg(registers::sp);
 	if (offset < 0)
 	{
-		Register sp = this->allocator.allocate();
-		this->emit_raw("move ");
-		this->emit_register_use(sp);
-		this->emit_raw(" sp \n");
-
-		// offsets are off-by-one
-		// -1 is actually 0
-
-		this->emit_raw("move sp ");
-		this->emit_raw(std::to_string(this->top_env.frame_size() + offset));
-		this->emit_raw("\n");
-
-		this->emit_raw("push ");
-		this->emit_raw(source.to_string());
-		this->emit_raw("\n");
-
-		this->emit_raw("move sp ");
-		this->emit_register_use(sp);
-		this->emit_raw("\n");
+		Register saved_sp = this->allocator.allocate();
+		this->emit(Opcode::Move, { this->operand(saved_sp), sp });
 
+		// statics are counted from the bottom of the stack, off by one
+		this->emit(Opcode::Move, { sp, Operand::number(-offset - 1) });
+		this->emit(Opcode::Push, { this->operand(source) });
+		this->emit(Opcode::Move, { sp, this->operand(saved_sp) });
 		return;
 	}
 
 	if (offset == 0)
 	{
-		this->emit_raw("sub sp sp 1\n");
-
-		this->emit_raw("push ");
-		this->emit_raw(source.to_string());
-		this->emit_raw("\n");
+		this->emit(Opcode::Sub, { sp, sp, Operand::number(1) });
+		this->emit(Opcode::Push, { this->operand(source) });
 		return;
 	}
-	this->emit_raw("sub sp sp ");
-	this->emit_raw(std::to_string(offset + 1));
-	this->emit_raw("\n");
-
-	this->emit_raw("push ");
-	this->emit_raw(source.to_string());
-	this->emit_raw("\n");
-
-	this->emit_raw("add sp sp ");
-	this->emit_raw(std::to_string(offset));
-	this->emit_raw("\n");
+	this->emit(Opcode::Sub, { sp, sp, Operand::number(offset + 1) });
+	this->emit(Opcode::Push, { this->operand(source) });
+	this->emit(Opcode::Add, { sp, sp, Operand::number(offset) });
 }
 
 void* CodeGenerator::visitExprVariable(Expr::Variable& expr)
 {
-	Register reg = this->allocator.allocate();
-	std::unique_ptr<StackVariable> var = this->env->resolve(expr.name.lexeme);
-	if (!var)
+	this->source_line = expr.name.line;
+	const StackVariable& var = this->variable(expr.slot, expr.name);
+	if (var.register_index != LinearScan::NoRegister)
 	{
-		throw std::runtime_error("Attempt to use undefined variable.");
+		return new RegisterOrLiteral(this->get_variable_register(var));
 	}
-	this->emit_load_into(var->offset, &reg);
-	return new RegisterOrLiteral(reg);
+	Register reg = this->allocate_temporary();
+	this->emit_load_into(this->offset_of(var), &reg);
+	return new RegisterOrLiteral(std::move(reg));
 }
 
 void* CodeGenerator::visitExprAssignment(Expr::Assignment& expr)
 {
 	std::unique_ptr<RegisterOrLiteral> handle = this->visit_expr(expr.value);
 	RegisterOrLiteral& value = *handle;
-	std::unique_ptr<StackVariable> var = this->env->resolve(expr.name.lexeme);
-	if (!var)
+	this->source_line = expr.name.line;
+	const StackVariable& var = this->variable(expr.slot, expr.name);
+	if (var.register_index != LinearScan::NoRegister)
 	{
-		throw std::runtime_error("Attempt to use undefined variable.");
+		if (!value.is_register() || value.get_register().index() != var.register_index)
+		{
+			this->emit(Opcode::Move, { Operand::reg(var.register_index), this->operand(value) });
+		}
+		return nullptr;
 	}
-	this->emit_store_into(var->offset, value);
+	this->emit_store_into(this->offset_of(var), value);
 	return nullptr;
 }
 
 void* CodeGenerator::visitStmtReturn(Stmt::Return& expr)
 {
+	this->source_line = expr.keyword.line;
 	this->comment("return statement for ");
 	this->comment(this->env->function_name().substr(sizeof("@function")));
 
+	if (expr.tail_call)
+	{
+		this->emit_tail_call(expr.value->as<Expr::Call>());
+		return nullptr;
+	}
+
 	std::unique_ptr<RegisterOrLiteral> return_value;
 
 	// push return value
@@ -765,43 +948,42 @@ void* CodeGenerator::visitStmtReturn(Stmt::Return& expr)
 		return_value = this->visit_expr(expr.value);
 	}
 
-	int return_address_offset = this->env->resolve("@return")->offset;
-	this->emit_load_into(return_address_offset, "ra");
-
-	StackEnvironment* env_to_pop = this->env;
-	int stack_values_to_pop = 0;
-	while (env_to_pop->is_in_function())
+	if (!this->leaf_function)
 	{
-		stack_values_to_pop += env_to_pop->frame_size();
-		env_to_pop = env_to_pop->parent;
+		this->emit_load_into(this->offset_of(*this->return_address), Operand::reg(registers::ra));
 	}
 
+	int stack_values_to_pop = this->function_frame_size();
 	if (stack_values_to_pop > 0)
 	{
-		this->emit_raw("sub sp sp ");
-		this->emit_raw(std::to_string(stack_values_to_pop));
-		this->emit_raw("\n");
+		this->emit(Opcode::Sub, { Operand::reg(registers::sp), Operand::reg(registers::sp), Operand::number(stack_values_to_pop) });
 	}
 
-	if (return_value)
+	if (this->convention == CallingConvention::Registers)
+	{
+		if (return_value && !(return_value->is_register() && return_value->get_register().index() == return_register))
+		{
+			this->emit(Opcode::Move, { Operand::reg(return_register), this->operand(*return_value) });
+		}
+	}
+	else if (return_value)
 	{
-		this->emit_raw("push ");
-		this->emit_raw(return_value->to_string());
-		this->emit_raw("\n");
+		this->emit(Opcode::Push, { this->operand(*return_value) });
 	}
 	else
 	{
-		this->emit_raw("push 0\n");
+		this->emit(Opcode::Push, { Operand::number(0) });
 	}
 
 	// jump to return address (loaded from @return)
-	this->emit_raw("j ra\n");
+	this->emit(Opcode::Jump, { Operand::reg(registers::ra) });
 
 	return nullptr;
 }
 
 void* CodeGenerator::visitStmtFunction(Stmt::Function& expr)
 {
+	this->source_line = expr.name.line;
 	// function definitons are only on top level
 	const Variable& function = *this->m_program.env().root()->get_variable(expr.name.lexeme);
 	std::string mangled_name = function.full_type().mangled_name();
@@ -809,26 +991,110 @@ void* CodeGenerator::visitStmtFunction(Stmt::Function& expr)
 	this->comment("Function definition for");
 	this->comment(mangled_name.substr(sizeof("@function")));
 
-	this->emit_raw(mangled_name);
-	this->emit_raw(":");
+	this->place_label(this->buffer.named_label(mangled_name));
 	this->push_env(mangled_name);
+	this->function_env = this->env;
+	this->allocator.reset_high_water_mark();
+
+	// locals are packed into the top registers, temporaries are allocated from the bottom
+	std::vector<int> pool;
+	for (int i = static_cast<int>(this->allocator.register_count() - this->static_registers.size()) - 1; i >= temporary_registers; i--)
+	{
+		pool.push_back(i);
+	}
+	this->leaf_function = this->call_graph->is_leaf(expr);
+	this->locals = std::make_unique<LinearScan>(this->m_program, expr);
+	if (this->leaf_function)
+	{
+		// nothing is called, so arguments can stay where the caller put them
+		for (size_t i = 0; i < expr.params.size() && this->passes_in_register(i); i++)
+		{
+			this->locals->precolor_parameter(i, static_cast<int>(i));
+		}
+	}
+	this->locals->allocate(pool);
+	this->layout = std::make_unique<FrameLayout>(this->m_program, expr);
+	this->frame.assign(this->layout->size(), nullptr);
+	this->stack_locals.assign(this->layout->size(), false);
+	this->share_slots = this->call_graph->is_recursive(expr);
+	for (size_t slot = 0; slot < this->frame.size(); slot++)
+	{
+		const auto& found = this->static_variables.find(this->layout->symbol(static_cast<int>(slot)));
+		if (found != this->static_variables.end())
+		{
+			this->frame[slot] = found->second;
+		}
+	}
 
-	// get all arguments
-	for (const auto& param : expr.params)
+	// get all arguments the caller pushed
+	std::vector<StackVariable*> params(expr.params.size(), nullptr);
+	for (size_t i = 0; i < expr.params.size(); i++)
 	{
-		this->env->define(param.name.lexeme, 1);
+		if (!this->passes_in_register(i))
+		{
+			params[i] = &this->env->define(expr.params[i].name.lexeme, 1);
+		}
 	}
 
-	// then define return address of previous function
-	this->env->define("@return", 1);
+	if (!this->leaf_function)
+	{
+		// then define return address of previous function
+		this->return_address = &this->env->define("@return", 1);
+
+		// this is loaded into @return
+		this->emit(Opcode::Push, { Operand::reg(registers::ra) });
+	}
 
-	// this is loaded into @return
-	this->emit_raw("push ra\n");
+	for (size_t i = 0; i < expr.params.size(); i++)
+	{
+		const std::string& name = expr.params[i].name.lexeme;
+		int index = this->locals->register_of_parameter(i);
+		if (index == LinearScan::NoRegister)
+		{
+			if (this->passes_in_register(i))
+			{
+				// no register left for it, so it gets a stack slot like a local
+				this->emit(Opcode::Push, { Operand::reg(static_cast<int>(i)) });
+				params[i] = &this->env->define(name, 1);
+			}
+			continue;
+		}
+		Register reg = this->allocator.allocate(index);
+		if (this->passes_in_register(i))
+		{
+			if (index != static_cast<int>(i))
+			{
+				this->emit(Opcode::Move, { this->operand(reg), Operand::reg(static_cast<int>(i)) });
+			}
+			params[i] = &this->env->define_register(name, index);
+		}
+		else
+		{
+			// arguments that live in registers are loaded once, their stack slots are left as they are
+			this->emit_load_into(this->offset_of(*params[i]), &reg);
+			params[i]->register_index = index;
+		}
+		this->variable_registers.emplace(index, VariableRegister{ this->locals->parameter_symbol(i), std::move(reg) });
+	}
+	for (size_t i = 0; i < params.size(); i++)
+	{
+		int slot = this->layout->parameter_slot(i);
+		if (slot != FrameLayout::NoSlot)
+		{
+			this->frame[slot] = params[i];
+		}
+	}
+	this->parameter_slots = std::move(params);
+	this->prologue_frame_size = this->env->frame_size();
+	this->body_label = this->create_label();
+	this->place_label(this->body_label);
 
 	for (auto& stmt : expr.body)
 	{
 		this->visit_stmt(stmt);
 	}
+	this->compiler.info(std::string("Register pressure in ") + expr.name.lexeme + " peaked at " + std::to_string(this->allocator.high_water_mark()) +
+		" of " + std::to_string(this->allocator.register_count()) + " registers.");
 
 	if (expr.body.size() == 0)
 	{
@@ -842,24 +1108,92 @@ void* CodeGenerator::visitStmtFunction(Stmt::Function& expr)
 
 	this->env = this->env->pop_to_function();
 	this->pop_env();
+	this->variable_registers.clear();
+	this->locals.reset();
+	this->layout.reset();
+	this->frame.clear();
+	this->stack_locals.clear();
+	this->return_address = nullptr;
+	this->function_env = nullptr;
+	this->parameter_slots.clear();
 
 	return nullptr;
 }
 
-void CodeGenerator::store_register_values()
+bool CodeGenerator::passes_in_register(size_t argument) const
 {
-	if (this->stored_registers.size() > 0)
-	{
-		throw std::runtime_error("Attempted to store register values while already having registers stored.");
-	}
-	this->stored_registers = this->allocator.registers_in_use();
-	for (int i = 0; i < this->stored_registers.size(); i++)
+	return this->convention == CallingConvention::Registers && argument < argument_registers;
+}
+
+void CodeGenerator::emit_parallel_move(std::vector<std::pair<int, Operand>> moves)
+{
+	moves.erase(std::remove_if(moves.begin(), moves.end(), [](const std::pair<int, Operand>& move) { return move.second.is_register(move.first); }), moves.end());
+	// held until every move is done, so scratch registers are never handed out twice
+	std::vector<Register> reserved;
+	while (moves.size())
 	{
-		const Register& reg = this->stored_registers[i];
-		this->env->define(std::string("@s_") + reg.to_string(), 1);
-		this->emit_raw("push ");
-		this->emit_register_use(reg);
-		this->emit_raw("\n");
+		// a destination can be written once no other pending move still reads it
+		auto ready = std::find_if(moves.begin(), moves.end(), [&moves](const std::pair<int, Operand>& move)
+			{
+				return std::none_of(moves.begin(), moves.end(), [&move](const std::pair<int, Operand>& other) { return other.second.is_register(move.first); });
+			});
+		if (ready != moves.end())
+		{
+			this->emit(Opcode::Move, { Operand::reg(ready->first), ready->second });
+			moves.erase(ready);
+			continue;
+		}
+		// only cycles are left, free one destination by copying it aside
+		for (const auto& move : moves)
+		{
+			if (!this->allocator.is_register_in_use(move.first))
+			{
+				reserved.push_back(this->allocator.allocate(move.first));
+			}
+		}
+		Register scratch = this->allocator.allocate();
+		reserved.push_back(scratch.share());
+		int blocked = moves.front().first;
+		this->emit(Opcode::Move, { this->operand(scratch), Operand::reg(blocked) });
+		for (auto& move : moves)
+		{
+			if (move.second.is_register(blocked))
+			{
+				move.second = this->operand(scratch);
+			}
+		}
+	}
+}
+
+std::string CodeGenerator::call_slot_name(const std::string& name) const
+{
+	// calls nest inside arguments, so every level gets its own names
+	return std::string("@") + std::to_string(this->stored_registers.size()) + "_" + name;
+}
+
+void CodeGenerator::store_register_values(const Expr::Call& call)
+{
+	// variables that are not read after the call do not need to survive it, temporaries always do
+	std::vector<Register> live;
+	for (Register& reg : this->allocator.registers_in_use())
+	{
+		if (this->is_static_register(reg.index()))
+		{
+			// the callee may assign the static, which has to be kept
+			continue;
+		}
+		const auto& home = this->variable_registers.find(reg.index());
+		if (this->locals && home != this->variable_registers.end() && !this->locals->live_after(home->second.symbol, &call))
+		{
+			continue;
+		}
+		live.push_back(std::move(reg));
+	}
+	this->stored_registers.push_back(std::move(live));
+	for (const Register& reg : this->stored_registers.back())
+	{
+		this->env->define(this->call_slot_name(std::string("s_") + reg.to_string()), 1);
+		this->emit(Opcode::Push, { this->operand(reg) });
 	}
 }
 
@@ -867,21 +1201,94 @@ void CodeGenerator::restore_register_values()
 {
 	if (this->stored_registers.size() == 0)
 	{
-		return;
+		throw std::logic_error("Attempted to restore register values without having stored any.");
 	}
-	for (auto it = this->stored_registers.rbegin(); it != this->stored_registers.rend(); ++it)
+	const std::vector<Register>& stored = this->stored_registers.back();
+	for (auto it = stored.rbegin(); it != stored.rend(); ++it)
 	{
 		const Register& reg = *it;
-		this->env->forget(std::string("@s_") + reg.to_string());
-		this->emit_raw("pop ");
-		this->emit_register_use(reg);
-		this->emit_raw("\n");
+		this->env->forget(this->call_slot_name(std::string("s_") + reg.to_string()));
+		this->emit(Opcode::Pop, { this->operand(reg) });
 	}
-	this->stored_registers.clear();
+	this->stored_registers.pop_back();
+}
+
+int CodeGenerator::function_frame_size() const
+{
+	return this->env->depth();
+}
+
+void CodeGenerator::emit_tail_call(Expr::Call& call)
+{
+	this->source_line = call.paren.line;
+	const Variable* var = this->m_program.env().root()->get_variable(call.callee->as<Expr::Variable>().name.lexeme);
+	if (!var)
+	{
+		throw std::logic_error("Attempted to call a non-existent function.");
+	}
+	std::string name = var->full_type().mangled_name();
+	bool recursive = name == this->env->function_name();
+	this->comment(recursive ? "looping back into" : "tail calling function");
+	this->comment(var->full_type().unmangled_name());
+
+	// every argument is computed before anything of this frame is overwritten
+	std::vector<std::unique_ptr<RegisterOrLiteral>> arguments;
+	for (size_t i = 0; i < call.arguments.size(); i++)
+	{
+		arguments.push_back(this->visit_expr(call.arguments[i]));
+		for (size_t later = i + 1; later < call.arguments.size(); later++)
+		{
+			this->protect_static(arguments.back(), *call.arguments[later]);
+		}
+	}
+
+	Operand sp = Operand::reg(registers::sp);
+	int frame_size = this->function_frame_size();
+	std::vector<std::pair<int, Operand>> moves;
+	if (recursive)
+	{
+		// the prologue is kept, only the parameters change
+		for (size_t i = 0; i < arguments.size(); i++)
+		{
+			int index = this->locals->register_of_parameter(i);
+			if (index != LinearScan::NoRegister)
+			{
+				moves.push_back({ index, this->operand(*arguments[i]) });
+				continue;
+			}
+			this->emit_store_into(this->offset_of(*this->parameter_slots[i]), *arguments[i]);
+		}
+		this->emit_parallel_move(std::move(moves));
+		if (frame_size > this->prologue_frame_size)
+		{
+			this->emit(Opcode::Sub, { sp, sp, Operand::number(frame_size - this->prologue_frame_size) });
+		}
+		this->emit(Opcode::Jump, { Operand::label(this->body_label) });
+		return;
+	}
+
+	// the callee returns straight to our caller, so it gets our return address and our frame
+	this->emit_load_into(this->offset_of(*this->return_address), Operand::reg(registers::ra));
+	if (frame_size > 0)
+	{
+		this->emit(Opcode::Sub, { sp, sp, Operand::number(frame_size) });
+	}
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		if (this->passes_in_register(i))
+		{
+			moves.push_back({ static_cast<int>(i), this->operand(*arguments[i]) });
+			continue;
+		}
+		this->emit(Opcode::Push, { this->operand(*arguments[i]) });
+	}
+	this->emit_parallel_move(std::move(moves));
+	this->emit(Opcode::Jump, { Operand::label(this->buffer.named_label(name)) });
 }
 
 void* CodeGenerator::visitExprCall(Expr::Call& expr)
 {
+	this->source_line = expr.paren.line;
 	std::string name;
 	if (expr.callee->is<Expr::Variable>())
 	{
@@ -900,65 +1307,295 @@ void* CodeGenerator::visitExprCall(Expr::Call& expr)
 	}
 
 	this->comment("Storing register values");
-	this->store_register_values();
+	this->store_register_values(expr);
 	this->comment("Stored.");
-	
-	for (auto& arg : expr.arguments)
+
+	// pushed arguments move the stack pointer, so they are tracked until the callee pops them
+	std::vector<std::string> pushed_arguments;
+	std::vector<std::unique_ptr<RegisterOrLiteral>> register_arguments;
+	for (size_t i = 0; i < expr.arguments.size(); i++)
 	{
-		std::unique_ptr<RegisterOrLiteral> loaded = this->visit_expr(arg);
-		this->emit_raw("push ");
-		this->emit_raw(loaded->to_string());
-		this->emit_raw("\n");
+		std::unique_ptr<RegisterOrLiteral> loaded = this->visit_expr(expr.arguments[i]);
+		if (this->passes_in_register(i))
+		{
+			for (size_t later = i + 1; later < expr.arguments.size(); later++)
+			{
+				this->protect_static(loaded, *expr.arguments[later]);
+			}
+			register_arguments.push_back(std::move(loaded));
+			continue;
+		}
+		this->emit(Opcode::Push, { this->operand(*loaded) });
+		pushed_arguments.push_back(this->call_slot_name(std::string("arg") + std::to_string(i)));
+		this->env->define(pushed_arguments.back(), 1);
 	}
 
-	this->emit_raw("jal ");
-	this->emit_raw(name);
-	this->emit_raw("\n");
+	// everything in the argument registers was stored above, so they can be overwritten
+	std::vector<std::pair<int, Operand>> moves;
+	for (size_t i = 0; i < register_arguments.size(); i++)
+	{
+		moves.push_back({ static_cast<int>(i), this->operand(*register_arguments[i]) });
+	}
+	this->emit_parallel_move(std::move(moves));
+	register_arguments.clear();
+
+	this->source_line = expr.paren.line;
+	this->emit(Opcode::JumpAndLink, { Operand::label(this->buffer.named_label(name)) });
+	for (auto it = pushed_arguments.rbegin(); it != pushed_arguments.rend(); ++it)
+	{
+		this->env->forget(*it);
+	}
 
 	this->comment("Getting return value");
-	Register return_value = this->allocator.allocate();
-	this->emit_raw("pop ");
-	this->emit_register_use(return_value);
-	this->emit_raw("\n");
+	std::unique_ptr<Register> return_value;
+	if (this->convention == CallingConvention::Registers)
+	{
+		// the return register may be one of the stored registers, which are about to be restored
+		if (this->allocator.is_register_in_use(return_register))
+		{
+			return_value = std::make_unique<Register>(this->allocator.allocate());
+			this->emit(Opcode::Move, { this->operand(*return_value), Operand::reg(return_register) });
+		}
+		else
+		{
+			return_value = std::make_unique<Register>(this->allocator.allocate(return_register));
+		}
+	}
+	else
+	{
+		return_value = std::make_unique<Register>(this->allocator.allocate());
+		this->emit(Opcode::Pop, { this->operand(*return_value) });
+	}
 
 	this->comment("Restoring register values");
 	this->restore_register_values();
 	this->comment("Restored.");
-	
-	return new RegisterOrLiteral(return_value);
+
+	return new RegisterOrLiteral(std::move(*return_value));
+}
+
+// roughly the lines evaluating an expression takes, has_effects is set when it calls or assigns
+static int evaluation_cost(Expr& expr, bool& has_effects)
+{
+	if (expr.is<Expr::Grouping>())
+	{
+		return evaluation_cost(*expr.as<Expr::Grouping>().expression, has_effects);
+	}
+	if (expr.is<Expr::Unary>())
+	{
+		return 1 + evaluation_cost(*expr.as<Expr::Unary>().right, has_effects);
+	}
+	if (expr.is<Expr::Binary>())
+	{
+		Expr::Binary& binary = expr.as<Expr::Binary>();
+		return 1 + evaluation_cost(*binary.left, has_effects) + evaluation_cost(*binary.right, has_effects);
+	}
+	if (expr.is<Expr::Logical>())
+	{
+		Expr::Logical& logical = expr.as<Expr::Logical>();
+		return 1 + evaluation_cost(*logical.left, has_effects) + evaluation_cost(*logical.right, has_effects);
+	}
+	if (expr.is<Expr::DeviceLoad>())
+	{
+		return 1 + evaluation_cost(*expr.as<Expr::DeviceLoad>().device, has_effects);
+	}
+	if (expr.is<Expr::Select>())
+	{
+		Expr::Select& select = expr.as<Expr::Select>();
+		return 1 + evaluation_cost(*select.condition, has_effects) + evaluation_cost(*select.if_true, has_effects) + evaluation_cost(*select.if_false, has_effects);
+	}
+	if (expr.is<Expr::Assignment>())
+	{
+		has_effects = true;
+		return 1 + evaluation_cost(*expr.as<Expr::Assignment>().value, has_effects);
+	}
+	if (expr.is<Expr::Call>())
+	{
+		has_effects = true;
+		int cost = 2;
+		for (auto& arg : expr.as<Expr::Call>().arguments)
+		{
+			cost += 1 + evaluation_cost(*arg, has_effects);
+		}
+		return cost;
+	}
+	// literals and variables are operands
+	return 0;
+}
+
+int CodeGenerator::register_need(Expr& expr) const
+{
+	// the first operand of a pair is held in a register while the second is evaluated, if it took one
+	auto pair = [](int first, int second) { return std::max({ first, second + (first > 0 ? 1 : 0), 1 }); };
+	if (expr.is<Expr::Grouping>())
+	{
+		return this->register_need(*expr.as<Expr::Grouping>().expression);
+	}
+	if (expr.is<Expr::Literal>())
+	{
+		return 0;
+	}
+	if (expr.is<Expr::Variable>())
+	{
+		Expr::Variable& variable = expr.as<Expr::Variable>();
+		return this->variable(variable.slot, variable.name).register_index != LinearScan::NoRegister ? 0 : 1;
+	}
+	if (expr.is<Expr::Unary>())
+	{
+		return std::max(this->register_need(*expr.as<Expr::Unary>().right), 1);
+	}
+	if (expr.is<Expr::Binary>())
+	{
+		Expr::Binary& binary = expr.as<Expr::Binary>();
+		int left = this->register_need(*binary.left);
+		int right = this->register_need(*binary.right);
+		return std::min(pair(left, right), pair(right, left));
+	}
+	if (expr.is<Expr::Logical>())
+	{
+		Expr::Logical& logical = expr.as<Expr::Logical>();
+		int left = this->register_need(*logical.left);
+		int right = this->register_need(*logical.right);
+		return std::min(pair(left, right), pair(right, left));
+	}
+	if (expr.is<Expr::Select>())
+	{
+		Expr::Select& select = expr.as<Expr::Select>();
+		return pair(pair(this->register_need(*select.condition), this->register_need(*select.if_true)), this->register_need(*select.if_false));
+	}
+	if (expr.is<Expr::DeviceLoad>())
+	{
+		return std::max(this->register_need(*expr.as<Expr::DeviceLoad>().device), 1);
+	}
+	if (expr.is<Expr::Assignment>())
+	{
+		return this->register_need(*expr.as<Expr::Assignment>().value);
+	}
+	if (expr.is<Expr::Call>())
+	{
+		// arguments are evaluated one at a time after everything live was stored
+		int need = 1;
+		for (auto& arg : expr.as<Expr::Call>().arguments)
+		{
+			need = std::max(need, this->register_need(*arg));
+		}
+		return need;
+	}
+	return 1;
+}
+
+void CodeGenerator::evaluate_operands(std::shared_ptr<Expr> left, std::shared_ptr<Expr> right,
+	std::unique_ptr<RegisterOrLiteral>& left_value, std::unique_ptr<RegisterOrLiteral>& right_value)
+{
+	bool has_effects = false;
+	evaluation_cost(*left, has_effects);
+	evaluation_cost(*right, has_effects);
+	if (has_effects || this->register_need(*right) <= this->register_need(*left))
+	{
+		left_value = this->visit_expr(left);
+		this->protect_static(left_value, *right);
+		this->hold(*left_value);
+		right_value = this->visit_expr(right);
+		this->unhold(*left_value);
+		return;
+	}
+	// a variable read on both sides would have its register let go after its last read in numbering order,
+	// which is now evaluated before the left side reads it
+	std::vector<const void*> releases;
+	std::vector<const void*>* outer = this->deferred_releases;
+	this->deferred_releases = &releases;
+	right_value = this->visit_expr(right);
+	this->hold(*right_value);
+	left_value = this->visit_expr(left);
+	this->unhold(*right_value);
+	this->deferred_releases = outer;
+	for (const void* node : releases)
+	{
+		this->release_variable_registers(node);
+	}
+}
+
+void CodeGenerator::protect_static(std::unique_ptr<RegisterOrLiteral>& value, Expr& later)
+{
+	if (!value->is_register() || !this->is_static_register(value->get_register().index()))
+	{
+		return;
+	}
+	if (!expr_util::has_effects(later))
+	{
+		return;
+	}
+	Register copy = this->allocate_temporary();
+	this->emit(Opcode::Move, { this->operand(copy), this->operand(*value) });
+	value = std::make_unique<RegisterOrLiteral>(std::move(copy));
 }
 
 void* CodeGenerator::visitExprLogical(Expr::Logical& expr)
 {
-	std::unique_ptr<RegisterOrLiteral> left_handle = this->visit_expr(expr.left);
-	std::unique_ptr<RegisterOrLiteral> right_handle = this->visit_expr(expr.right);
+	bool has_effects = false;
+	int cost = evaluation_cost(*expr.right, has_effects);
+	if (has_effects || cost > short_circuit_overhead)
+	{
+		// the right side only runs when the left side does not decide the result
+		std::unique_ptr<RegisterOrLiteral> left_handle = this->visit_expr(expr.left);
+		this->source_line = expr.op.line;
+		Register output = this->get_or_make_output_register(*left_handle, *left_handle);
+		if (!left_handle->is_register() || left_handle->get_register().index() != output.index())
+		{
+			this->emit(Opcode::Move, { this->operand(output), this->operand(*left_handle) });
+		}
+		left_handle.reset();
+		LabelId end = this->create_label();
+		this->emit(expr.op.type == TokenType::AND ? Opcode::BranchEqualZero : Opcode::BranchNotEqualZero, { this->operand(output), Operand::label(end) });
+		// a value spilled on only one path could not be loaded back after the paths join
+		size_t spill_floor = this->spill_floor;
+		this->spill_floor = this->held_values.size();
+		std::unique_ptr<RegisterOrLiteral> right_handle = this->visit_expr(expr.right);
+		this->spill_floor = spill_floor;
+		this->source_line = expr.op.line;
+		this->emit(Opcode::Move, { this->operand(output), this->operand(*right_handle) });
+		this->place_label(end);
+		return new RegisterOrLiteral(std::move(output));
+	}
+	std::unique_ptr<RegisterOrLiteral> left_handle;
+	std::unique_ptr<RegisterOrLiteral> right_handle;
+	this->evaluate_operands(expr.left, expr.right, left_handle, right_handle);
+	this->source_line = expr.op.line;
 	RegisterOrLiteral& left = *left_handle;
 	RegisterOrLiteral& right = *right_handle;
 	Register output = this->get_or_make_output_register(left, right);
 	switch (expr.op.type)
 	{
 	case TokenType::AND:
-		this->emit_raw("min ");
-		this->emit_register_use(output);
-		this->emit_raw(" ");
-		this->emit_raw(left.to_string());
-		this->emit_raw(" ");
-		this->emit_raw(right.to_string());
-		this->emit_raw("\n");
+		this->emit(Opcode::Min, { this->operand(output), this->operand(left), this->operand(right) });
 		break;
 	case TokenType::OR:
-		this->emit_raw("max ");
-		this->emit_register_use(output);
-		this->emit_raw(" ");
-		this->emit_raw(left.to_string());
-		this->emit_raw(" ");
-		this->emit_raw(right.to_string());
-		this->emit_raw("\n");
+		this->emit(Opcode::Max, { this->operand(output), this->operand(left), this->operand(right) });
 		break;
 	default:
 		throw std::logic_error("");
 	}
-	return new RegisterOrLiteral(output);
+	return new RegisterOrLiteral(std::move(output));
+}
+
+void* CodeGenerator::visitExprSelect(Expr::Select& expr)
+{
+	std::unique_ptr<RegisterOrLiteral> condition = this->visit_expr(expr.condition);
+	this->protect_static(condition, *expr.if_true);
+	this->protect_static(condition, *expr.if_false);
+	this->hold(*condition);
+	std::unique_ptr<RegisterOrLiteral> if_true = this->visit_expr(expr.if_true);
+	this->protect_static(if_true, *expr.if_false);
+	this->hold(*if_true);
+	std::unique_ptr<RegisterOrLiteral> if_false = this->visit_expr(expr.if_false);
+	this->unhold(*if_true);
+	this->unhold(*condition);
+	this->source_line = expr.token.line;
+	// any temporary of the three can hold the result
+	const RegisterOrLiteral& value = if_true->is_register() && !this->is_variable_register(if_true->get_register()) ? *if_true : *if_false;
+	Register output = this->get_or_make_output_register(*condition, value);
+	this->emit(Opcode::Select, { this->operand(output), this->operand(*condition), this->operand(*if_true), this->operand(*if_false) });
+	return new RegisterOrLiteral(std::move(output));
 }
 
 void CodeGenerator::visit_stmt(std::unique_ptr<Stmt>& stmt)
@@ -978,6 +1615,7 @@ void CodeGenerator::visit_stmt(std::unique_ptr<Stmt>& stmt)
 			return;
 		}
 		stmt->accept(*this);
+		this->release_variable_registers(stmt.get());
 		return;
 	}
 }
@@ -989,11 +1627,6 @@ void* CodeGenerator::visitStmtExpression(Stmt::Expression& expr)
 	return nullptr;
 }
 
-static bool acceptable_variable_character(char character)
-{
-	return std::isalnum(character) || character == '&';
-}
-
 namespace string
 {
 	static bool startswith(const std::string& str, char character)
@@ -1031,29 +1664,6 @@ namespace string
 	}
 }
 
-static std::vector<std::string> extract_variables_from_str(const std::string& in)
-{
-	std::vector<std::string> result;
-	for (size_t i = 0; i < in.size(); ++i)
-	{
-		// if current is $ and prev was whitespace
-		if (in[i] == '$' && (i == 0 || !acceptable_variable_character(in[i - 1])))
-		{
-			size_t j = i + 1;
-			while (j < in.size() && acceptable_variable_character(in[j]))
-			{
-				++j;
-			}
-			if (j > i + 1 && (j == in.size() || !acceptable_variable_character(in[j])))
-			{
-				result.push_back(in.substr(i, j - i));
-				i = j - 1;
-			}
-		}
-	}
-	return result;
-}
-
 static std::vector<size_t> extract_registers_from_str(const std::string& in)
 {
 	std::vector<size_t> result;
@@ -1095,7 +1705,7 @@ static std::vector<size_t> extract_unique_registers_from_str(const std::string&
 
 struct AsmVariableBinding
 {
-	std::unique_ptr<StackVariable> var;
+	const StackVariable* var;
 	Register allocated;
 	bool load;
 	bool store;
@@ -1112,21 +1722,29 @@ void* CodeGenerator::visitStmtAsm(Stmt::Asm& expr)
 	{
 		throw std::logic_error("ASM statement was non-string");
 	}
+	this->source_line = expr.token.line;
 	std::string raw = *str.literal.literal.string;
 	std::vector<size_t> registers_used = extract_unique_registers_from_str(raw);
 	std::vector<size_t> registers_pushed;
 	registers_pushed.reserve(registers_used.size());
+	// registers the asm names itself are never bound to its variables
+	std::vector<Register> reserved;
+	std::unordered_set<int> excluded;
 	for (const auto& reg : registers_used)
 	{
 		try
 		{
 			if (this->allocator.is_register_in_use(reg))
 			{
-				this->emit_raw("push r");
-				this->emit_raw(std::to_string(reg));
-				this->emit_raw("\n");
+				this->emit(Opcode::Push, { Operand::reg(static_cast<int>(reg)) });
+				this->env->define(this->call_slot_name(std::string("asm_r") + std::to_string(reg)), 1);
 				registers_pushed.push_back(reg);
 			}
+			else
+			{
+				reserved.push_back(this->allocator.allocate(reg));
+			}
+			excluded.insert(static_cast<int>(reg));
 		}
 		catch (const std::out_of_range&)
 		{
@@ -1134,14 +1752,24 @@ void* CodeGenerator::visitStmtAsm(Stmt::Asm& expr)
 				" which is out of range for possible registers (0-" + std::to_string(this->allocator.register_count() - 1) + ")");
 		}
 	}
-	std::vector<std::string> vars = extract_variables_from_str(raw);
+	std::vector<std::string> vars = expr.referenced_variables();
+	for (const auto& rawname : vars)
+	{
+		const StackVariable* var = this->env->resolve(rawname.substr(string::startswith(rawname, "$&") ? 2 : 1));
+		if (var && var->register_index != LinearScan::NoRegister)
+		{
+			excluded.insert(var->register_index);
+		}
+	}
+	// registers saved to make room for variables when none are free
+	std::vector<Register> borrowed;
 	std::unordered_map<std::string, AsmVariableBinding> varname_to_operand;
 	for (const auto& rawname : vars)
 	{
 		if (string::startswith(rawname, "$&"))
 		{
 			std::string varname = rawname.substr(2);
-			std::unique_ptr<StackVariable> var = this->env->resolve(varname);
+			const StackVariable* var = this->env->resolve(varname);
 			if (!var)
 			{
 				this->error(expr.token, std::string("asm statement referenced non-existent variable \"") + varname + "\"");
@@ -1153,14 +1781,15 @@ void* CodeGenerator::visitStmtAsm(Stmt::Asm& expr)
 				string::replacefirst(raw, rawname, operand.allocated.to_string());
 				continue;
 			}
-			Register allocated = this->allocator.allocate();
+			Register allocated = var->register_index != LinearScan::NoRegister ? this->get_variable_register(*var) : this->borrow_register(expr, excluded, borrowed);
+			excluded.insert(allocated.index());
 			string::replacefirst(raw, rawname, allocated.to_string());
-			varname_to_operand.emplace(varname, AsmVariableBinding{std::move(var), allocated, false, true});
+			varname_to_operand.emplace(varname, AsmVariableBinding{ var, std::move(allocated), false, true });
 		}
 		else
 		{
 			std::string varname = rawname.substr(1);
-			std::unique_ptr<StackVariable> var = this->env->resolve(varname);
+			const StackVariable* var = this->env->resolve(varname);
 			if (!var)
 			{
 				this->error(expr.token, std::string("asm statement referenced non-existent variable \"") + varname + "\"");
@@ -1172,39 +1801,89 @@ void* CodeGenerator::visitStmtAsm(Stmt::Asm& expr)
 				string::replacefirst(raw, rawname, operand.allocated.to_string());
 				continue;
 			}
-			Register allocated = this->allocator.allocate();
+			Register allocated = var->register_index != LinearScan::NoRegister ? this->get_variable_register(*var) : this->borrow_register(expr, excluded, borrowed);
+			excluded.insert(allocated.index());
 			string::replacefirst(raw, rawname, allocated.to_string());
-			varname_to_operand.emplace(varname, AsmVariableBinding{ std::move(var), allocated, true, false });
+			varname_to_operand.emplace(varname, AsmVariableBinding{ var, std::move(allocated), true, false });
 		}
 	}
+	// variables held in registers are bound directly and need no loads or stores
 	for (auto& operand_pair : varname_to_operand)
 	{
 		auto& operand = operand_pair.second;
-		if (operand.load)
+		if (operand.load && operand.var->register_index == LinearScan::NoRegister)
 		{
-			this->emit_load_into(operand.var->offset, &operand.allocated);
+			this->emit_load_into(this->offset_of(*operand.var), &operand.allocated);
 		}
 	}
 	this->emit_raw(raw);
-	this->emit_raw("\n");
-	for (auto it = registers_pushed.rbegin(); it != registers_pushed.rend(); ++it)
-	{
-		this->emit_raw("pop r");
-		this->emit_raw(std::to_string(*it));
-		this->emit_raw("\n");
-	}
 	for (const auto& operand_pair : varname_to_operand)
 	{
 		const auto& operand = operand_pair.second;
-		if (operand.store)
+		if (operand.store && operand.var->register_index == LinearScan::NoRegister)
 		{
-			this->emit_store_into(operand.var->offset, operand.allocated);
+			this->emit_store_into(this->offset_of(*operand.var), RegisterOrLiteral(operand.allocated.share()));
 		}
 	}
+	for (auto it = borrowed.rbegin(); it != borrowed.rend(); ++it)
+	{
+		this->env->forget(this->call_slot_name(std::string("asm_") + it->to_string()));
+		this->emit(Opcode::Pop, { this->operand(*it) });
+	}
+	for (auto it = registers_pushed.rbegin(); it != registers_pushed.rend(); ++it)
+	{
+		this->env->forget(this->call_slot_name(std::string("asm_r") + std::to_string(*it)));
+		this->emit(Opcode::Pop, { Operand::reg(static_cast<int>(*it)) });
+	}
 
 	return nullptr;
 }
 
+Register CodeGenerator::borrow_register(Stmt::Asm& stmt, const std::unordered_set<int>& excluded, std::vector<Register>& saved)
+{
+	if (this->allocator.has_free_register())
+	{
+		return this->allocator.allocate();
+	}
+	const VariableRegister* furthest = nullptr;
+	int furthest_use = 0;
+	for (const auto& held : this->variable_registers)
+	{
+		if (excluded.count(held.first))
+		{
+			continue;
+		}
+		int next_use = this->locals ? this->locals->next_use(held.second.symbol, stmt.downcast()) : 0;
+		if (next_use < 0)
+		{
+			// dead, so it can be overwritten without saving it
+			return held.second.reg.share();
+		}
+		if (!furthest || next_use > furthest_use)
+		{
+			furthest = &held.second;
+			furthest_use = next_use;
+		}
+	}
+	const Register* victim = furthest ? &furthest->reg : nullptr;
+	if (!victim)
+	{
+		// statics may be read by anything called later, so they are only taken when nothing else is left
+		const auto& found = std::find_if(this->static_registers.begin(), this->static_registers.end(),
+			[&excluded](const std::pair<const int, Register>& held) { return !excluded.count(held.first); });
+		if (found == this->static_registers.end())
+		{
+			this->error(stmt.token, "asm statement binds more variables than there are registers.");
+		}
+		victim = &found->second;
+	}
+	Register reg = victim->share();
+	this->emit(Opcode::Push, { this->operand(reg) });
+	this->env->define(this->call_slot_name(std::string("asm_") + reg.to_string()), 1);
+	saved.push_back(reg.share());
+	return reg;
+}
+
 void* CodeGenerator::visitStmtPrint(Stmt::Print& expr)
 {
 	return nullptr;
@@ -1212,26 +1891,73 @@ void* CodeGenerator::visitStmtPrint(Stmt::Print& expr)
 
 void* CodeGenerator::visitStmtStatic(Stmt::Static& expr)
 {
+	this->source_line = expr.var->as<Stmt::Variable>().name.line;
 	std::unique_ptr<RegisterOrLiteral> value = this->visit_expr(expr.var->as<Stmt::Variable>().initalizer);
-	this->emit_raw("push ");
-	this->emit_raw(value->to_string());
-	this->emit_raw("\n");
-	this->env->define_static(expr.var->as<Stmt::Variable>().name.lexeme, 1);
+	SymbolTable::Index symbol = this->m_program.table.lookup_index(expr.var);
+	if (expr.in_register)
+	{
+		int index = static_cast<int>(this->allocator.register_count() - this->static_registers.size()) - 1;
+		Register reg = this->allocator.allocate(index);
+		this->emit(Opcode::Move, { this->operand(reg), this->operand(*value) });
+		this->static_registers.emplace(index, std::move(reg));
+		this->static_variables[symbol] = &this->env->define_register(expr.var->as<Stmt::Variable>().name.lexeme, index);
+		return nullptr;
+	}
+	this->emit(Opcode::Push, { this->operand(*value) });
+	this->static_variables[symbol] = &this->env->define_static(expr.var->as<Stmt::Variable>().name.lexeme, 1);
 	return nullptr;
 }
 
 void* CodeGenerator::visitStmtVariable(Stmt::Variable& expr)
 {
 	std::unique_ptr<RegisterOrLiteral> value = this->visit_expr(expr.initalizer);
-	this->emit_raw("push ");
-	this->emit_raw(value->to_string());
-	this->emit_raw("\n");
-
-	this->env->define(expr.name.lexeme, 1);
+	this->source_line = expr.name.line;
+	int index = this->locals ? this->locals->register_of_definition(expr) : LinearScan::NoRegister;
+	if (index != LinearScan::NoRegister)
+	{
+		this->bind_variable_register(this->m_program.table.lookup_index(expr.downcast()), index, *value);
+		this->define_local(expr, this->env->define_register(expr.name.lexeme, index));
+		return nullptr;
+	}
+	int position = this->share_slots ? this->env->take_free_slot() : -1;
+	if (position >= 0)
+	{
+		StackVariable& var = this->env->define_in_slot(expr.name.lexeme, position);
+		this->emit_store_into(this->offset_of(var), *value);
+		this->define_local(expr, var);
+	}
+	else
+	{
+		this->emit(Opcode::Push, { this->operand(*value) });
+		this->define_local(expr, this->env->define(expr.name.lexeme, 1));
+	}
+	if (this->layout && expr.slot != FrameLayout::NoSlot)
+	{
+		this->stack_locals[expr.slot] = true;
+	}
 
 	return nullptr;
 }
 
+void CodeGenerator::define_local(const Stmt::Variable& stmt, const StackVariable& var)
+{
+	if (this->layout && stmt.slot != FrameLayout::NoSlot)
+	{
+		this->frame[stmt.slot] = &var;
+	}
+}
+
+void CodeGenerator::free_stack_slot(SymbolTable::Index symbol)
+{
+	int slot = this->layout->slot(symbol);
+	if (slot == FrameLayout::NoSlot || !this->stack_locals[slot])
+	{
+		return;
+	}
+	this->stack_locals[slot] = false;
+	this->env->free_slot(this->frame[slot]->position);
+}
+
 void* CodeGenerator::visitStmtBlock(Stmt::Block& expr)
 {
 	this->push_env();
@@ -1247,9 +1973,8 @@ void* CodeGenerator::visitStmtBlock(Stmt::Block& expr)
 	}
 	if (this->env->frame_size() > 0)
 	{
-		this->emit_raw("sub sp sp ");
-		this->emit_raw(std::to_string(this->env->frame_size()));
-		this->emit_raw("\n");
+		this->source_line = expr.right_brace.line;
+		this->emit(Opcode::Sub, { Operand::reg(registers::sp), Operand::reg(registers::sp), Operand::number(this->env->frame_size()) });
 	}
 	this->pop_env();
 
@@ -1258,49 +1983,94 @@ void* CodeGenerator::visitStmtBlock(Stmt::Block& expr)
 
 Register CodeGenerator::get_or_make_output_register(const RegisterOrLiteral& a, const RegisterOrLiteral& b)
 {
-	if (a.is_literal() && b.is_literal())
+	// a register holding a variable must keep its value, and so must one held by anything besides the operand,
+	// such as a variable whose interval just ended but was already read into an earlier argument
+	if (a.is_register() && !this->is_variable_register(a.get_register()) && !a.get_register().is_shared())
 	{
-		return this->allocator.allocate();
+		return a.get_register().share();
 	}
-	if (a.is_register())
+	if (b.is_register() && !this->is_variable_register(b.get_register()) && !b.get_register().is_shared())
 	{
-		return a.get_register();
+		return b.get_register().share();
 	}
-	if (b.is_register())
+	return this->allocate_temporary();
+}
+
+Register CodeGenerator::allocate_temporary()
+{
+	if (this->allocator.has_free_register())
+	{
+		return this->allocator.allocate();
+	}
+	for (size_t i = this->spill_floor; i < this->held_values.size(); i++)
 	{
-		return b.get_register();
+		RegisterOrLiteral& value = *this->held_values[i];
+		// variables keep their registers, and a register held anywhere else cannot be taken from under it
+		if (!value.is_register() || this->is_variable_register(value.get_register()) || value.get_register().is_shared())
+		{
+			continue;
+		}
+		this->emit(Opcode::Push, { this->operand(value) });
+		std::string slot = std::string("@spill") + std::to_string(this->spilled_values.size());
+		this->env->define(slot, 1);
+		this->spilled_values.push_back(SpilledValue{ slot, &value });
+		value.spill();
+		return this->allocator.allocate();
 	}
-	throw std::runtime_error("Unreachable code.");
+	throw std::runtime_error("Register allocation failed. No available registers and nothing to spill.");
 }
 
-Placeholder CodeGenerator::emit_placeholder()
+void CodeGenerator::hold(RegisterOrLiteral& value)
 {
-	int val = this->current_placeholder_value++;
-	this->emit_raw("__@placeholder#");
-	this->emit_raw(std::to_string(val));
-	return Placeholder{ val };
+	this->held_values.push_back(&value);
 }
 
-void CodeGenerator::emit_replace_placeholder(const Placeholder& placeholder, const std::string& val)
+void CodeGenerator::unhold(RegisterOrLiteral& value)
 {
-	std::string placeholder_text = std::string("__@placeholder#") + std::to_string(placeholder.id);
-	size_t placeholder_pos = this->code.find(placeholder_text);
-	if (placeholder_pos == std::string::npos)
+	if (!this->held_values.size() || this->held_values.back() != &value)
 	{
-		throw std::runtime_error("Attempted to replace a placeholder which does not exist.");
+		throw std::logic_error("Attempted to release a value that was not the last one held.");
+	}
+	this->held_values.pop_back();
+	if (value.is_register() || value.is_literal())
+	{
+		return;
+	}
+	Register reg = this->allocate_temporary();
+	size_t index = 0;
+	while (this->spilled_values[index].value != &value)
+	{
+		index++;
+	}
+	if (index + 1 == this->spilled_values.size())
+	{
+		this->emit(Opcode::Pop, { this->operand(reg) });
+		this->env->forget(this->spilled_values.back().slot);
+		this->spilled_values.pop_back();
+	}
+	else
+	{
+		this->emit_load_into(this->offset_of(*this->env->resolve(this->spilled_values[index].slot)), &reg);
+		this->spilled_values[index].value = nullptr;
+	}
+	value.reload(std::move(reg));
+	// slots only come off the top, so ones already loaded wait for the values spilled above them
+	int dropped = 0;
+	while (this->spilled_values.size() && !this->spilled_values.back().value)
+	{
+		this->env->forget(this->spilled_values.back().slot);
+		this->spilled_values.pop_back();
+		dropped++;
+	}
+	if (dropped)
+	{
+		this->emit(Opcode::Sub, { Operand::reg(registers::sp), Operand::reg(registers::sp), Operand::number(dropped) });
 	}
-	this->code.erase(placeholder_pos, placeholder_text.length());
-	this->code.insert(placeholder_pos, val);
-}
-
-int CodeGenerator::current_line()
-{
-	return static_cast<int>(std::count(this->code.begin(), this->code.end(), '\n'));
 }
 
 void* CodeGenerator::visitStmtIf(Stmt::If& expr)
 {
-	std::unique_ptr<RegisterOrLiteral> value = this->visit_expr(expr.condition);
+	this->source_line = expr.token.line;
 	
 	/*
 
@@ -1318,31 +2088,23 @@ void* CodeGenerator::visitStmtIf(Stmt::If& expr)
 
 	*/
 
-	this->emit_raw("breqz ");
-	this->emit_raw(value->to_string());
-	this->emit_raw(" ");
-	Placeholder placeholder = this->emit_placeholder();
-	this->emit_raw("\n");
+	LabelId false_branch = this->create_label();
+	this->emit_branch(expr.condition, false_branch, false);
 
-	int true_branch_length = this->current_line();
 	this->visit_stmt(expr.branch_true);
-	std::unique_ptr<Placeholder> jump_over_false;
+	LabelId end = false_branch;
 	if (expr.branch_false)
 	{
-		this->emit_raw("jr ");
-		jump_over_false = std::make_unique<Placeholder>(this->emit_placeholder());
-		this->emit_raw("\n");
+		end = this->create_label();
+		this->emit(Opcode::JumpRelative, { Operand::label(end) });
 	}
 
-	true_branch_length = this->current_line() - true_branch_length;
-	this->emit_replace_placeholder(placeholder, std::to_string(true_branch_length + 1));
+	this->place_label(false_branch);
 
 	if (expr.branch_false)
 	{
-		int false_branch_length = this->current_line();
 		this->visit_stmt(expr.branch_false);
-		false_branch_length = this->current_line() - false_branch_length;
-		this->emit_replace_placeholder(*jump_over_false, std::to_string(false_branch_length + 1));
+		this->place_label(end);
 	}
 
 	return nullptr;
@@ -1350,117 +2112,166 @@ void* CodeGenerator::visitStmtIf(Stmt::If& expr)
 
 void CodeGenerator::comment(const std::string& val)
 {
-	this->emit_raw("#");
-	this->emit_raw(val);
-	this->emit_raw("\n");
+	this->buffer.emit(Instruction(Opcode::Comment, val, this->source_line));
 }
 
 void* CodeGenerator::visitExprDeviceLoad(Expr::DeviceLoad& expr)
 {
 	std::unique_ptr<RegisterOrLiteral> device = this->visit_expr(expr.device);
+	this->source_line = expr.logic_type.line;
 	const std::string& logic_type = expr.logic_type.literal.as_string();
-	Register output = this->allocator.allocate();
-	this->emit_raw("l ");
-	this->emit_register_use(output);
-	this->emit_raw(" ");
-	if (device->is_literal())
-	{
-		this->emit_raw("d");
-		int device_id = device->get_literal().as_integer();
-		if (device_id == -1)
-		{
-			this->emit_raw("b");
-		}
-		else if (device_id > 5 || device_id < -1)
-		{
-			this->error(expr.logic_type, std::string("Attempted to set device d") + std::to_string(device_id) + " which is out of range for dx {-1 <= x <= 5}.");
-			throw CodeGenerationError();
-		}
-		else
-		{
-			this->emit_raw(std::to_string(device->get_literal().as_integer()));
-		}
-	}
-	else
-	{
-		this->emit_raw("r");
-		this->emit_raw(device->get_register().to_string());
-	}
-	this->emit_raw(" ");
-	this->emit_raw(logic_type);
-	this->emit_raw("\n");
-	return new RegisterOrLiteral(output);
+	Register output = this->allocate_temporary();
+	this->emit(Opcode::Load, { this->operand(output), this->device_operand(*device, expr.logic_type), Operand::text(logic_type) });
+	return new RegisterOrLiteral(std::move(output));
 }
 
 void* CodeGenerator::visitStmtDeviceSet(Stmt::DeviceSet& expr)
 {
 	std::unique_ptr<RegisterOrLiteral> device = this->visit_expr(expr.device);
 	const std::string& logic_type = expr.logic_type.literal.as_string();
+	this->protect_static(device, *expr.value);
+	this->hold(*device);
 	std::unique_ptr<RegisterOrLiteral> value = this->visit_expr(expr.value);
-	this->emit_raw("s ");
-	if (device->is_literal())
+	this->unhold(*device);
+	this->source_line = expr.token.line;
+	this->emit(Opcode::Store, { this->device_operand(*device, expr.token), Operand::text(logic_type), this->operand(*value) });
+	return nullptr;
+}
+
+void CodeGenerator::emit_branch(std::shared_ptr<Expr> condition, LabelId target, bool when)
+{
+	while (condition->is<Expr::Grouping>())
+	{
+		condition = condition->as<Expr::Grouping>().expression;
+	}
+	if (condition->is<Expr::Unary>() && condition->as<Expr::Unary>().op.type == TokenType::BANG)
+	{
+		this->emit_branch(condition->as<Expr::Unary>().right, target, !when);
+		return;
+	}
+	if (condition->is<Expr::Logical>())
 	{
-		this->emit_raw("d");
-		int device_id = device->get_literal().as_integer();
-		if (device_id == -1)
+		Expr::Logical& logical = condition->as<Expr::Logical>();
+		bool is_and = logical.op.type == TokenType::AND;
+		if (is_and != when)
 		{
-			this->emit_raw("b");
+			// a false side of an and or a true side of an or decides it on its own
+			this->emit_branch(logical.left, target, when);
+			this->emit_branch(logical.right, target, when);
+			return;
 		}
-		else if (device_id > 5 || device_id < -1)
+		LabelId decided = this->create_label();
+		this->emit_branch(logical.left, decided, !when);
+		this->emit_branch(logical.right, target, when);
+		this->place_label(decided);
+		return;
+	}
+	if (condition->is<Expr::Binary>())
+	{
+		Expr::Binary& comparison = condition->as<Expr::Binary>();
+		Opcode taken;
+		Opcode not_taken;
+		bool fused = true;
+		switch (comparison.op.type)
 		{
-			this->error(expr.token, std::string("Attempted to set device d") + std::to_string(device_id) + " which is out of range for dx {-1 <= x <= 5}.");
-			throw CodeGenerationError();
+		case TokenType::LESS:
+			taken = Opcode::BranchLessThan;
+			not_taken = Opcode::BranchGreaterEqual;
+			break;
+		case TokenType::LESS_EQUAL:
+			taken = Opcode::BranchLessEqual;
+			not_taken = Opcode::BranchGreaterThan;
+			break;
+		case TokenType::GREATER:
+			taken = Opcode::BranchGreaterThan;
+			not_taken = Opcode::BranchLessEqual;
+			break;
+		case TokenType::GREATER_EQUAL:
+			taken = Opcode::BranchGreaterEqual;
+			not_taken = Opcode::BranchLessThan;
+			break;
+		case TokenType::EQUAL_EQUAL:
+			taken = Opcode::BranchEqual;
+			not_taken = Opcode::BranchNotEqual;
+			break;
+		case TokenType::BANG_EQUAL:
+			taken = Opcode::BranchNotEqual;
+			not_taken = Opcode::BranchEqual;
+			break;
+		default:
+			fused = false;
+			break;
 		}
-		else
+		if (fused)
 		{
-			this->emit_raw(std::to_string(device->get_literal().as_integer()));
+			std::unique_ptr<RegisterOrLiteral> left;
+			std::unique_ptr<RegisterOrLiteral> right;
+			this->evaluate_operands(comparison.left, comparison.right, left, right);
+			this->source_line = comparison.op.line;
+			this->emit(when ? taken : not_taken, { this->operand(*left), this->operand(*right), Operand::label(target) });
+			this->release_variable_registers(condition.get());
+			return;
 		}
 	}
-	else
-	{
-		this->emit_raw("r");
-		this->emit_raw(device->get_register().to_string());
-	}
-	this->emit_raw(" ");
-	this->emit_raw(logic_type);
-	this->emit_raw(" ");
-	this->emit_raw(value->to_string());
-	this->emit_raw("\n");
-	return nullptr;
+	std::unique_ptr<RegisterOrLiteral> value = this->visit_expr(condition);
+	this->emit(when ? Opcode::BranchNotEqualZero : Opcode::BranchEqualZero, { this->operand(*value), Operand::label(target) });
 }
 
 void* CodeGenerator::visitStmtWhile(Stmt::While& expr)
 {
+	this->source_line = expr.token.line;
 	if (expr.condition->is<Expr::Literal>())
 	{
 		Expr::Literal& condition = *dynamic_cast<Expr::Literal*>(expr.condition.get());
 		if (*condition.literal.literal.boolean)
 		{
-			int line = this->current_line();
+			LabelId start = this->create_label();
+			this->place_label(start);
 			// while (true)
 			this->visit_stmt(expr.body);
-			this->emit_raw("j ");
-			this->emit_raw(std::to_string(line));
-			this->emit_raw("\n");
+			this->emit(Opcode::Jump, { Operand::label(start) });
 		}
 		return nullptr;
 	}
-	int line = this->current_line();
-	std::unique_ptr<RegisterOrLiteral> condition = this->visit_expr(expr.condition);
-	
-	this->emit_raw("brlez ");
-	this->emit_raw(condition->to_string());
-	this->emit_raw(" ");
-	Placeholder placeholder = this->emit_placeholder();
-	this->emit_raw("\n");
-	
+	/*
+
+	the condition is tested at the bottom, so an iteration runs one branch instead of a branch and a jump
+
+	if !condition goto end      or      j test
+	start:                              start:
+	// body                             // body
+	if condition goto start             test:
+	end:                                if condition goto start
+
+	*/
+
+	LabelId start = this->create_label();
+	LabelId end = this->create_label();
+	bool has_effects = false;
+	// a guard repeats the condition, which is only worth it when it is a single branch
+	bool guarded = evaluation_cost(*expr.condition, has_effects) <= loop_guard_cost && !has_effects;
+	LabelId test = end;
+	if (guarded)
+	{
+		this->emit_branch(expr.condition, end, false);
+	}
+	else
+	{
+		test = this->create_label();
+		this->emit(Opcode::Jump, { Operand::label(test) });
+	}
+	this->place_label(start);
+
 	this->visit_stmt(expr.body);
 
-	this->emit_raw("j ");
-	this->emit_raw(std::to_string(line));
-	this->emit_raw("\n");
+	this->source_line = expr.token.line;
+	if (!guarded)
+	{
+		this->place_label(test);
+	}
+	this->emit_branch(expr.condition, start, true);
 
-	this->emit_replace_placeholder(placeholder, std::to_string(this->current_line() - line));
+	this->place_label(end);
 
 	return nullptr;
 }
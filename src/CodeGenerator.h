@@ -1,17 +1,26 @@
 #pragma once
 
+#include <array>
+#include <bitset>
+
 #include "TypeChecker.h"
+#include "Instruction.h"
+#include "LinearScan.h"
+#include "FrameLayout.h"
+#include "CallGraph.h"
 
-typedef std::shared_ptr<int> RegisterHandle;
+class RegisterAllocator;
 
 struct StackVariable
 {
-	StackVariable(const std::string& name, int size) :name(name), size(size), offset(0), is_static(false), id(0) {};
+	StackVariable(const std::string& name, int size) :name(name), size(size), position(0), is_static(false), register_index(LinearScan::NoRegister) {};
 	std::string name;
-	int offset;
+	// slots below it in the frame of its function, or below it in the statics for a static
+	int position;
 	int size;
 	bool is_static;
-	size_t id;
+	// register holding the value, reads and writes go here instead of the stack slot
+	int register_index;
 };
 
 class StackEnvironment
@@ -25,19 +34,28 @@ public:
 	StackEnvironment& operator=(const StackEnvironment& other) = delete;
 	StackEnvironment& operator=(StackEnvironment&& other)  noexcept;
 
-	void set_frame_size(int value);
+	// slots taken by this scope
 	int frame_size() const;
+	// slots taken from the start of the function, or by the statics on top level
+	int depth() const;
 
+	// only the latest definition of the scope can be forgotten, which is how values pushed for calls come and go
 	void forget(const std::string& name);
 	StackVariable& define(const std::string& name, int size);
 	StackVariable& define_static(const std::string& name, int size);
-	std::unique_ptr<StackVariable> resolve(const std::string& name);
+	StackVariable& define_register(const std::string& name, int register_index);
+	// puts the variable in a slot that was already pushed, the scope that pushed it keeps counting it
+	StackVariable& define_in_slot(const std::string& name, int position);
+	// the slot of a dead variable, which a later variable of the scope that pushed it or of a nested one can take
+	void free_slot(int position);
+	// the freed slot nearest the top in this scope or an enclosing one of the same function, or -1
+	int take_free_slot();
+	// names are only resolved for asm and code outside of functions, references in functions go through their slots
+	const StackVariable* resolve(const std::string& name) const;
 
 	bool is_in_function() const;
 	const std::string& function_name() const;
 
-	const std::vector<StackVariable*>& see_variables() const;
-
 	StackEnvironment* pop_to_function();
 	StackEnvironment* spawn();
 	StackEnvironment* spawn_in_function(const std::string& name);
@@ -50,32 +68,41 @@ private:
 	std::unordered_map<std::string, StackVariable> variables;
 	std::vector<StackVariable*> variable_list;
 	int m_frame_size;
+	// depth of the parent scope when this one was entered
+	int m_base;
+	std::vector<int> free_positions;
 };
 
+// one hold on a register, which goes back to the allocator once nothing holds it
 class Register
 {
 public:
-	explicit Register(RegisterHandle handle);
+	Register(RegisterAllocator& allocator, int index);
 	~Register();
-	Register(const Register& other);
+	Register(const Register& other) = delete;
 	Register(Register&& other) noexcept;
 
-	Register& operator=(Register& other) = default;
-	Register& operator=(Register&& other) = default;
+	Register& operator=(const Register& other) = delete;
+	Register& operator=(Register&& other) noexcept;
 
-	RegisterHandle* release();
-	RegisterHandle handle();
+	// another hold on the same register, for a second owner that needs it kept
+	Register share() const;
 	int index() const;
+	// held by something besides this
+	bool is_shared() const;
 
 	std::string to_string() const;
 private:
-	RegisterHandle register_handle;
+	void release();
+
+	RegisterAllocator* allocator;
+	int m_index;
 };
 
 class RegisterOrLiteral
 {
 public:
-	RegisterOrLiteral(const Register& reg);
+	RegisterOrLiteral(Register reg);
 	RegisterOrLiteral(const Literal& literal);
 	RegisterOrLiteral(const RegisterOrLiteral& other) = delete;
 	RegisterOrLiteral(RegisterOrLiteral&& other) noexcept;
@@ -89,6 +116,10 @@ public:
 	const Register& get_register() const;
 	const Literal& get_literal() const;
 
+	// gives the register up while the value is on the stack, neither a register nor a literal until reloaded
+	void spill();
+	void reload(Register reg);
+
 	std::string to_string() const;
 private:
 	std::unique_ptr<Register> m_reg;
@@ -98,20 +129,30 @@ private:
 class RegisterAllocator
 {
 public:
-	RegisterAllocator(size_t register_count);
-	~RegisterAllocator();
+	static constexpr size_t max_registers = 32;
+
+	explicit RegisterAllocator(size_t register_count);
 	Register allocate();
+	Register allocate(size_t id);
 
 	size_t register_count() const;
+	bool has_free_register() const;
 	bool is_register_in_use(size_t id) const;
-	std::vector<Register> registers_in_use() const;
+	// a hold on every register in use
+	std::vector<Register> registers_in_use();
+	// most registers in use at once since the last reset
+	size_t high_water_mark() const;
+	void reset_high_water_mark();
 private:
-	std::vector<RegisterHandle> registers;
-};
+	friend class Register;
 
-struct Placeholder
-{
-	int id;
+	void hold(int index);
+	void release(int index);
+
+	size_t m_register_count;
+	std::bitset<max_registers> in_use;
+	std::array<int, max_registers> holds;
+	size_t m_high_water_mark;
 };
 
 class CodeGenerator : public Expr::Visitor, public Stmt::Visitor
@@ -123,10 +164,19 @@ public:
 		FunctionLinkage,
 	};
 
-	CodeGenerator(Compiler& compiler, TypeCheckedProgram& program);
+	enum class CallingConvention
+	{
+		// arguments and the return value go through the stack
+		Stack,
+		// the first argument_registers arguments go in r0 and up, the return value comes back in r0
+		Registers,
+	};
+
+	CodeGenerator(Compiler& compiler, TypeCheckedProgram& program, CallingConvention convention = CallingConvention::Stack);
 	void error(const Token& token, const std::string& str);
 
 	std::string generate();
+	const InstructionBuffer& instructions() const;
 
 	Register get_or_make_output_register(const RegisterOrLiteral& a, const RegisterOrLiteral& b);
 
@@ -143,6 +193,7 @@ public:
 	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
 	virtual void* visitExprCall(Expr::Call& expr) override;
 	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
 	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
 
 	virtual void* visitStmtExpression(Stmt::Expression& expr) override;
@@ -157,37 +208,133 @@ public:
 	virtual void* visitStmtStatic(Stmt::Static& expr) override;
 	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& expr) override;
 private:
-	void store_register_values();
+	// registers left over for temporaries when every local register is taken
+	static constexpr int temporary_registers = 6;
+	static constexpr int argument_registers = 4;
+	static constexpr int return_register = 0;
+	static_assert(argument_registers <= temporary_registers, "argument registers may not hold locals");
+	// extra lines the branching form of and/or takes over min/max
+	static constexpr int short_circuit_overhead = 2;
+	// conditions up to this cost are repeated in front of a rotated loop instead of jumping to its test
+	static constexpr int loop_guard_cost = 1;
+
+	struct VariableRegister
+	{
+		SymbolTable::Index symbol;
+		Register reg;
+	};
+
+	bool passes_in_register(size_t argument) const;
+	void emit_parallel_move(std::vector<std::pair<int, Operand>> moves);
+	std::string call_slot_name(const std::string& name) const;
+	void store_register_values(const Expr::Call& call);
 	void restore_register_values();
+	void emit_tail_call(Expr::Call& call);
+	// jumps to target when the condition is `when`, comparisons become a single branch and
+	// and/or only evaluate their right side when the left does not decide the jump
+	void emit_branch(std::shared_ptr<Expr> condition, LabelId target, bool when);
+	int function_frame_size() const;
 
-	std::vector<Register> stored_registers;
+	// declared before everything holding registers, which give them back to it as they are destroyed
+	RegisterAllocator allocator;
+	// one entry per call currently being generated
+	std::vector<std::vector<Register>> stored_registers;
+
+	struct SpilledValue
+	{
+		std::string slot;
+		// null once it was loaded back while a value spilled after it still sat above it
+		RegisterOrLiteral* value;
+	};
+
+	// takes a free register, or spills the held temporary that is used furthest in the future
+	Register allocate_temporary();
+	// keeps the value while another operand is evaluated, which may spill it
+	void hold(RegisterOrLiteral& value);
+	// the value is about to be used, so it is loaded back if it was spilled
+	void unhold(RegisterOrLiteral& value);
+	// registers evaluating the expression ties up at its peak, including the one its value ends up in
+	int register_need(Expr& expr) const;
+	// evaluates the side needing more registers first when neither side has effects, so the other is held for less
+	void evaluate_operands(std::shared_ptr<Expr> left, std::shared_ptr<Expr> right,
+		std::unique_ptr<RegisterOrLiteral>& left_value, std::unique_ptr<RegisterOrLiteral>& right_value);
+	// a static read into its register would change under a later sibling that calls or assigns, so it is copied first
+	void protect_static(std::unique_ptr<RegisterOrLiteral>& value, Expr& later);
+	// saves a register no operand of the asm uses so it can hold one of them, preferring the variable read furthest away
+	Register borrow_register(Stmt::Asm& stmt, const std::unordered_set<int>& excluded, std::vector<Register>& saved);
+
+	// in the order they were held, so the first one is used last
+	std::vector<RegisterOrLiteral*> held_values;
+	// values held before this index belong to code around a conditionally run part and are not spilled in it
+	size_t spill_floor = 0;
+	// in stack order
+	std::vector<SpilledValue> spilled_values;
+	// set while the right operand is evaluated before the left, which the intervals of the variables they read do not expect
+	std::vector<const void*>* deferred_releases = nullptr;
+
+	Register bind_variable_register(SymbolTable::Index symbol, int index, const RegisterOrLiteral& value);
+	void release_variable_registers(const void* node);
+	bool is_variable_register(const Register& reg) const;
+	Register get_variable_register(const StackVariable& var);
+	// the variable in the slot, or the one with the name outside of functions
+	const StackVariable& variable(int slot, const Token& name) const;
+	void define_local(const Stmt::Variable& stmt, const StackVariable& var);
+	void free_stack_slot(SymbolTable::Index symbol);
+	// slots from the top of the stack to the variable, negative for statics
+	int offset_of(const StackVariable& var) const;
+	bool is_static_register(int index) const;
+
+	std::unique_ptr<CallGraph> call_graph;
+	// the current function calls nothing, so ra is never saved
+	bool leaf_function = false;
+	std::unique_ptr<LinearScan> locals;
+	std::unique_ptr<FrameLayout> layout;
+	// what each slot of the layout refers to, filled in as the function defines it
+	std::vector<const StackVariable*> frame;
+	const StackVariable* return_address = nullptr;
+	// writing a local into an old slot takes more lines than pushing it, so slots are only shared
+	// where the frame can be on the stack many times
+	bool share_slots = false;
+	// layout slots of locals that were pushed, which give their stack slot back once they are dead
+	std::vector<bool> stack_locals;
+	std::unordered_map<SymbolTable::Index, const StackVariable*> static_variables;
+	// self tail calls overwrite the parameters and jump back to just after the prologue
+	StackEnvironment* function_env = nullptr;
+	std::vector<StackVariable*> parameter_slots;
+	int prologue_frame_size = 0;
+	LabelId body_label = 0;
+	// keyed by register index
+	std::unordered_map<int, VariableRegister> variable_registers;
+	// statics kept in registers, taken from the top and held for the whole program
+	std::unordered_map<int, Register> static_registers;
 
 	std::string get_register_name(const Register& reg);
 
+	static Operand operand(const Register& reg);
+	static Operand operand(const RegisterOrLiteral& value);
+	Operand device_operand(const RegisterOrLiteral& device, const Token& token);
+
 	void comment(const std::string& val);
+	void emit(Opcode opcode, std::vector<Operand> operands);
 	void emit_raw(const std::string& val);
-	void emit_register_use(const Register& reg);
-	void emit_register_use(const Register& a, const Register& b);
 	void emit_peek_stack_from_into(Register* reg);
 	void emit_store_into(int offset, const RegisterOrLiteral& source);
-	void emit_load_into(int offset, const std::string& register_label);
+	void emit_load_into(int offset, const Operand& destination);
 	void emit_load_into(int offset, Register* reg);
 
-	Placeholder emit_placeholder();
-	void emit_replace_placeholder(const Placeholder& placeholder, const std::string& val);
-
-	int current_placeholder_value;
-	int current_line();
+	LabelId create_label();
+	void place_label(LabelId label);
 
 	void push_env();
 	void push_env(const std::string& name);
 	void pop_env();
 
 	Pass pass = Pass::GlobalLinkage;
+	CallingConvention convention;
 	StackEnvironment* env;
 	StackEnvironment top_env;
-	RegisterAllocator allocator;
-	std::string code;
+	InstructionBuffer buffer;
+	int source_line;
 	Compiler& compiler;
 	TypeCheckedProgram& m_program;
 };
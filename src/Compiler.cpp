@@ -2,6 +2,12 @@
 #include "Interpreter.h"
 #include "TypeChecker.h"
 #include "CodeGenerator.h"
+#include "DeadCodeElimination.h"
+#include "Inliner.h"
+#include "LoopInvariantMotion.h"
+#include "Propagation.h"
+#include "StaticPromotion.h"
+#include "ValueNumbering.h"
 #include "Timer.h"
 
 const std::unordered_map<std::string, NativeFunction::reference_type>& Compiler::native_functions()
@@ -40,7 +46,7 @@ void Compiler::compile(const std::string& path)
 	this->info(std::string("Parsing took ") + std::to_string(timer.start() * 1000.0) + "ms.");
 	this->info("Typechecking...");
 	TypeChecker checker(*this, std::move(program));
-	TypeCheckedProgram env = checker.check();
+	std::unique_ptr<TypeCheckedProgram> env = std::make_unique<TypeCheckedProgram>(checker.check());
 	this->info(std::string("Typing took ") + std::to_string(timer.start() * 1000.0) + "ms.");
 	if (this->had_error)
 	{
@@ -48,12 +54,77 @@ void Compiler::compile(const std::string& path)
 		printf("Aborting before code generation.\n");
 		return;
 	}
+	this->info("Removing dead code...");
+	DeadCodeElimination eliminator(*this, *env);
+	eliminator.run();
+	this->info(std::string("Removing dead code took ") + std::to_string(timer.start() * 1000.0) + "ms.");
+	this->info("Promoting statics...");
+	StaticPromotion promotion(*this, *env);
+	promotion.run();
+	this->info(std::string("Promotion took ") + std::to_string(timer.start() * 1000.0) + "ms.");
 	this->info("Optimizing...");
-	Optimizer optimizer(*this, env);
+	Optimizer optimizer(*this, *env);
 	optimizer.optimize();
 	this->info(std::string("Optimizing took ") + std::to_string(timer.start() * 1000.0) + "ms.");
+	this->info("Inlining...");
+	Inliner inliner(*this, *env);
+	if (inliner.run())
+	{
+		// copied bodies need scopes and symbols of their own
+		TypeChecker rechecker(*this, std::move(env->statements()));
+		env = std::make_unique<TypeCheckedProgram>(rechecker.check());
+		if (this->had_error)
+		{
+			printf("Errors detected after inlining.\n");
+			printf("Aborting before code generation.\n");
+			return;
+		}
+		// arguments copied into the bodies can be folded again
+		Optimizer reoptimizer(*this, *env);
+		reoptimizer.optimize();
+	}
+	this->info(std::string("Inlining took ") + std::to_string(timer.start() * 1000.0) + "ms.");
+	this->info("Propagating values...");
+	Propagation propagation(*this, *env);
+	bool propagated = propagation.run();
+	if (propagated)
+	{
+		// the optimizer enters the scopes of blocks, including ones its first run put in place of dead branches
+		TypeChecker rechecker(*this, std::move(env->statements()));
+		env = std::make_unique<TypeCheckedProgram>(rechecker.check());
+		if (this->had_error)
+		{
+			printf("Errors detected after propagation.\n");
+			printf("Aborting before code generation.\n");
+			return;
+		}
+		// literals put in place of variables can be folded again
+		Optimizer refolder(*this, *env);
+		refolder.optimize();
+	}
+	this->info(std::string("Propagation took ") + std::to_string(timer.start() * 1000.0) + "ms.");
+	this->info("Numbering values...");
+	ValueNumbering numbering(*this, *env);
+	bool reused = numbering.run();
+	this->info(std::string("Numbering took ") + std::to_string(timer.start() * 1000.0) + "ms.");
+	this->info("Hoisting loop invariants...");
+	LoopInvariantMotion hoister(*this, *env);
+	bool hoisted = hoister.run();
+	if (propagated || reused || hoisted)
+	{
+		// reused and hoisted values are new locals, propagated ones have new reads
+		TypeChecker rechecker(*this, std::move(env->statements()));
+		env = std::make_unique<TypeCheckedProgram>(rechecker.check());
+		if (this->had_error)
+		{
+			printf("Errors detected after propagation, numbering and hoisting.\n");
+			printf("Aborting before code generation.\n");
+			return;
+		}
+	}
+	this->info(std::string("Hoisting took ") + std::to_string(timer.start() * 1000.0) + "ms.");
 	this->info("Generating code...");
-	CodeGenerator generator(*this, env);
+	CodeGenerator generator(*this, *env, this->register_calls ? CodeGenerator::CallingConvention::Registers : CodeGenerator::CallingConvention::Stack);
 	std::string code = generator.generate();
 	this->info(std::string("Code generation took ") + std::to_string(timer.start() * 1000.0) + "ms.");
 	if (this->had_error)
@@ -71,6 +142,11 @@ void Compiler::compile(const std::string& path)
 	printf("Compiling took %fms.\n", total_timer.time() * 1000.0);
 }
 
+void Compiler::use_register_calls(bool enabled)
+{
+	this->register_calls = enabled;
+}
+
 void Compiler::error(int line, const std::string& message)
 {
 	this->had_error = true;
@@ -82,6 +158,12 @@ void Compiler::report(int line, const std::string& where, const std::string& mes
 	printf("ERROR: on line %i: %s %s\n", line, where.c_str(), message.c_str());
 }
 
+std::string Compiler::fresh_name(const std::string& tag)
+{
+	// identifiers cannot start with a digit, so these never clash with anything the user wrote
+	return std::to_string(this->fresh_names++) + tag;
+}
+
 void Compiler::info(const std::string& message)
 {
 	if (this->level >= ReportingLevel::All)
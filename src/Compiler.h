@@ -13,10 +13,14 @@ class Compiler : public Expr::Visitor, public Stmt::Visitor
 {
 public:
 	void compile(const std::string& path);
+	// pass the first arguments and return values of functions in registers instead of on the stack
+	void use_register_calls(bool enabled);
 	void info(const std::string& message);
 	void warn(int line, const std::string& warning);
 	void error(int line, const std::string& message);
 	void report(int line, const std::string& where, const std::string& message);
+	// a new identifier for a variable a pass introduces, ending in the tag
+	std::string fresh_name(const std::string& tag);
 private:
 	static const std::unordered_map<std::string, NativeFunction::reference_type>& native_functions();
 	enum class ReportingLevel
@@ -27,4 +31,6 @@ private:
 	};
 	ReportingLevel level = ReportingLevel::All;
 	bool had_error = false;
+	bool register_calls = false;
+	int fresh_names = 0;
 };
@@ -0,0 +1,99 @@
+#include "DeadCodeElimination.h"
+#include "CallGraph.h"
+#include "Compiler.h"
+
+DeadCodeElimination::DeadCodeElimination(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program), removed_statements(0)
+{}
+
+void DeadCodeElimination::run()
+{
+	this->remove_unreachable_functions();
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			this->remove_unreachable_statements(stmt->as<Stmt::Function>().body, true);
+		}
+	}
+	if (this->removed_statements)
+	{
+		this->compiler.info(std::string("Removed ") + std::to_string(this->removed_statements) + " statements that can never run");
+	}
+}
+
+void DeadCodeElimination::remove_unreachable_functions()
+{
+	std::vector<std::unique_ptr<Stmt>>& statements = this->program.statements();
+	CallGraph graph(statements);
+	Stmt::Function* main = graph.function("main");
+	if (!main)
+	{
+		return;
+	}
+	std::unordered_set<const Stmt::Function*> reachable = graph.reachable(*main);
+	for (auto it = statements.begin(); it != statements.end();)
+	{
+		if ((*it)->is<Stmt::Function>() && !reachable.count(&(*it)->as<Stmt::Function>()))
+		{
+			this->compiler.info(std::string("Removed ") + (*it)->as<Stmt::Function>().name.lexeme + ", which is never called");
+			it = statements.erase(it);
+			continue;
+		}
+		++it;
+	}
+}
+
+void DeadCodeElimination::remove_unreachable_statements(std::vector<std::unique_ptr<Stmt>>& statements, bool function_body)
+{
+	for (size_t i = 0; i < statements.size(); i++)
+	{
+		this->remove_unreachable_statements(statements[i]);
+		bool ends = function_body ? statements[i]->is<Stmt::Return>() : always_returns(*statements[i]);
+		if (ends && i + 1 < statements.size())
+		{
+			this->removed_statements += static_cast<int>(statements.size() - i - 1);
+			statements.erase(statements.begin() + i + 1, statements.end());
+			return;
+		}
+	}
+}
+
+void DeadCodeElimination::remove_unreachable_statements(std::unique_ptr<Stmt>& stmt)
+{
+	if (stmt->is<Stmt::Block>())
+	{
+		this->remove_unreachable_statements(stmt->as<Stmt::Block>().statements, false);
+	}
+	else if (stmt->is<Stmt::If>())
+	{
+		this->remove_unreachable_statements(stmt->as<Stmt::If>().branch_true);
+		if (stmt->as<Stmt::If>().branch_false)
+		{
+			this->remove_unreachable_statements(stmt->as<Stmt::If>().branch_false);
+		}
+	}
+	else if (stmt->is<Stmt::While>())
+	{
+		this->remove_unreachable_statements(stmt->as<Stmt::While>().body);
+	}
+}
+
+bool DeadCodeElimination::always_returns(Stmt& stmt)
+{
+	if (stmt.is<Stmt::Return>())
+	{
+		return true;
+	}
+	if (stmt.is<Stmt::Block>())
+	{
+		auto& statements = stmt.as<Stmt::Block>().statements;
+		return std::any_of(statements.begin(), statements.end(), [](std::unique_ptr<Stmt>& inner) { return always_returns(*inner); });
+	}
+	if (stmt.is<Stmt::If>())
+	{
+		Stmt::If& branch = stmt.as<Stmt::If>();
+		return branch.branch_false && always_returns(*branch.branch_true) && always_returns(*branch.branch_false);
+	}
+	return false;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// Removes code that can never run.
+// Functions that main can not reach through calls are dropped, unused natives included, and statements that follow a
+// return, or an if that returns on both sides, are dropped from the block they are in.
+// Works on a checked program, its scopes are found by node so nothing has to be checked again.
+class DeadCodeElimination
+{
+public:
+	DeadCodeElimination(Compiler& compiler, TypeCheckedProgram& program);
+
+	void run();
+private:
+	void remove_unreachable_functions();
+	// a function body has to end in its return, so there only a return itself cuts off what follows
+	void remove_unreachable_statements(std::vector<std::unique_ptr<Stmt>>& statements, bool function_body);
+	void remove_unreachable_statements(std::unique_ptr<Stmt>& stmt);
+	static bool always_returns(Stmt& stmt);
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	int removed_statements;
+};
@@ -0,0 +1,58 @@
+#include "ExprUtil.h"
+#include "TypeChecker.h"
+
+namespace expr_util
+{
+	std::shared_ptr<Expr>& unwrap(std::shared_ptr<Expr>& expr)
+	{
+		std::shared_ptr<Expr>* inner = &expr;
+		while ((*inner)->is<Expr::Grouping>())
+		{
+			inner = &(*inner)->as<Expr::Grouping>().expression;
+		}
+		return *inner;
+	}
+
+	bool has_effects(Expr& expr)
+	{
+		if (expr.is<Expr::Call>() || expr.is<Expr::Assignment>())
+		{
+			return true;
+		}
+		if (expr.is<Expr::Grouping>())
+		{
+			return has_effects(*expr.as<Expr::Grouping>().expression);
+		}
+		if (expr.is<Expr::Unary>())
+		{
+			return has_effects(*expr.as<Expr::Unary>().right);
+		}
+		if (expr.is<Expr::Binary>())
+		{
+			return has_effects(*expr.as<Expr::Binary>().left) || has_effects(*expr.as<Expr::Binary>().right);
+		}
+		if (expr.is<Expr::Logical>())
+		{
+			return has_effects(*expr.as<Expr::Logical>().left) || has_effects(*expr.as<Expr::Logical>().right);
+		}
+		if (expr.is<Expr::Select>())
+		{
+			Expr::Select& select = expr.as<Expr::Select>();
+			return has_effects(*select.condition) || has_effects(*select.if_true) || has_effects(*select.if_false);
+		}
+		if (expr.is<Expr::DeviceLoad>())
+		{
+			return has_effects(*expr.as<Expr::DeviceLoad>().device);
+		}
+		return false;
+	}
+
+	bool is_computed_value(Expr& expr)
+	{
+		if (expr.type.pointer || (!expr.type.const_unqualified_equals(TypeChecker::t_number) && !expr.type.const_unqualified_equals(TypeChecker::t_boolean)))
+		{
+			return false;
+		}
+		return expr.is<Expr::Binary>() || expr.is<Expr::Unary>() || expr.is<Expr::Logical>() || expr.is<Expr::Select>() || expr.is<Expr::DeviceLoad>();
+	}
+}
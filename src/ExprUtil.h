@@ -0,0 +1,16 @@
+#pragma once
+
+#include <memory>
+
+#include "AST.h"
+
+// Questions about expressions that several passes ask.
+namespace expr_util
+{
+	// the expression under any parentheses
+	std::shared_ptr<Expr>& unwrap(std::shared_ptr<Expr>& expr);
+	// whether leaving the expression out would skip a call or an assignment
+	bool has_effects(Expr& expr);
+	// a number or boolean computed by an operator or a device read, which is worth keeping in a local instead of computing again
+	bool is_computed_value(Expr& expr);
+}
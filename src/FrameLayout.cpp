@@ -0,0 +1,184 @@
+#include "FrameLayout.h"
+
+FrameLayout::FrameLayout(TypeCheckedProgram& program, Stmt::Function& function)
+	:program(program)
+{
+	TypedEnvironment::Leaf* function_env = this->program.env().root()->enter(&function);
+	for (const auto& param : function.params)
+	{
+		const Variable* var = function_env ? function_env->get_variable(param.name.lexeme) : nullptr;
+		this->parameters.push_back(this->slot_of(var ? this->program.table.lookup_variable_index(var) : SymbolTable::Invalid));
+	}
+	for (auto& stmt : function.body)
+	{
+		stmt->accept(*this);
+	}
+}
+
+size_t FrameLayout::size() const
+{
+	return this->symbols.size();
+}
+
+int FrameLayout::parameter_slot(size_t index) const
+{
+	return this->parameters.at(index);
+}
+
+SymbolTable::Index FrameLayout::symbol(int slot) const
+{
+	return this->symbols.at(slot);
+}
+
+int FrameLayout::slot(SymbolTable::Index symbol) const
+{
+	const auto& found = this->slots.find(symbol);
+	return found == this->slots.end() ? NoSlot : found->second;
+}
+
+int FrameLayout::slot_of(SymbolTable::Index symbol)
+{
+	if (symbol == SymbolTable::Invalid)
+	{
+		return NoSlot;
+	}
+	const auto& found = this->slots.find(symbol);
+	if (found != this->slots.end())
+	{
+		return found->second;
+	}
+	int slot = static_cast<int>(this->symbols.size());
+	this->slots.emplace(symbol, slot);
+	this->symbols.push_back(symbol);
+	return slot;
+}
+
+void* FrameLayout::visitExprBinary(Expr::Binary& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitExprGrouping(Expr::Grouping& expr)
+{
+	expr.expression->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitExprUnary(Expr::Unary& expr)
+{
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitExprVariable(Expr::Variable& expr)
+{
+	expr.slot = this->slot_of(this->program.table.lookup_index(expr.downcast()));
+	return nullptr;
+}
+
+void* FrameLayout::visitExprAssignment(Expr::Assignment& expr)
+{
+	expr.value->accept(*this);
+	expr.slot = this->slot_of(this->program.table.lookup_index(expr.downcast()));
+	return nullptr;
+}
+
+void* FrameLayout::visitExprCall(Expr::Call& expr)
+{
+	// the callee is a function name, never a variable
+	for (auto& arg : expr.arguments)
+	{
+		arg->accept(*this);
+	}
+	return nullptr;
+}
+
+void* FrameLayout::visitExprLogical(Expr::Logical& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitExprSelect(Expr::Select& expr)
+{
+	expr.condition->accept(*this);
+	expr.if_true->accept(*this);
+	expr.if_false->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	expr.device->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtExpression(Stmt::Expression& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtPrint(Stmt::Print& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtVariable(Stmt::Variable& stmt)
+{
+	stmt.initalizer->accept(*this);
+	stmt.slot = this->slot_of(this->program.table.lookup_index(stmt.downcast()));
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtBlock(Stmt::Block& stmt)
+{
+	for (auto& statement : stmt.statements)
+	{
+		statement->accept(*this);
+	}
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.branch_true->accept(*this);
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+	}
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtFunction(Stmt::Function& stmt)
+{
+	throw std::logic_error("Functions cannot be nested.");
+}
+
+void* FrameLayout::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		stmt.value->accept(*this);
+	}
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtWhile(Stmt::While& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.body->accept(*this);
+	return nullptr;
+}
+
+void* FrameLayout::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	stmt.device->accept(*this);
+	stmt.value->accept(*this);
+	return nullptr;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+// Numbers the variables a single function refers to, so the code generator finds each one by index.
+// Every declaration, read and assignment in the function gets the slot of its variable written into it, parameters
+// and statics included, so generating a reference needs no lookup by name.
+class FrameLayout : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	static constexpr int NoSlot = -1;
+
+	FrameLayout(TypeCheckedProgram& program, Stmt::Function& function);
+
+	size_t size() const;
+	int parameter_slot(size_t index) const;
+	// the symbol each slot was given for
+	SymbolTable::Index symbol(int slot) const;
+	// the slot given for the symbol, NoSlot when nothing in the function refers to it
+	int slot(SymbolTable::Index symbol) const;
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprVariable(Expr::Variable& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtPrint(Stmt::Print& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtFunction(Stmt::Function& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	int slot_of(SymbolTable::Index symbol);
+
+	TypeCheckedProgram& program;
+	std::unordered_map<SymbolTable::Index, int> slots;
+	std::vector<SymbolTable::Index> symbols;
+	std::vector<int> parameters;
+};
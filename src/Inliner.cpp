@@ -0,0 +1,842 @@
+#include <algorithm>
+#include <sstream>
+
+#include "Inliner.h"
+#include "Compiler.h"
+
+FunctionSummary::FunctionSummary(Stmt::Function& function)
+	:cost(0), inlinable(true), returns(0)
+{
+	this->scopes.emplace_back();
+	for (const auto& param : function.params)
+	{
+		this->declare(param.name.lexeme);
+	}
+	for (auto& stmt : function.body)
+	{
+		stmt->accept(*this);
+	}
+	// anything but a final return would need a jump out of the copied body
+	if (!function.body.size() || !function.body.back()->is<Stmt::Return>() || this->returns != 1)
+	{
+		this->inlinable = false;
+	}
+	if (function.body.size() == 1 && function.body.back()->is<Stmt::Return>())
+	{
+		this->value = function.body.back()->as<Stmt::Return>().value;
+	}
+}
+
+void FunctionSummary::declare(const std::string& name)
+{
+	this->scopes.back().insert(name);
+	this->declared.insert(name);
+}
+
+bool FunctionSummary::is_local(const std::string& name) const
+{
+	for (const auto& scope : this->scopes)
+	{
+		if (scope.count(name))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void* FunctionSummary::visitExprBinary(Expr::Binary& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprGrouping(Expr::Grouping& expr)
+{
+	expr.expression->accept(*this);
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprUnary(Expr::Unary& expr)
+{
+	expr.right->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprVariable(Expr::Variable& expr)
+{
+	if (!this->is_local(expr.name.lexeme))
+	{
+		this->free.insert(expr.name.lexeme);
+	}
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprAssignment(Expr::Assignment& expr)
+{
+	expr.value->accept(*this);
+	if (this->is_local(expr.name.lexeme))
+	{
+		this->written.insert(expr.name.lexeme);
+	}
+	else
+	{
+		this->free.insert(expr.name.lexeme);
+	}
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprCall(Expr::Call& expr)
+{
+	for (auto& arg : expr.arguments)
+	{
+		arg->accept(*this);
+		this->cost++;
+	}
+	if (expr.callee->is<Expr::Variable>())
+	{
+		const std::string& name = expr.callee->as<Expr::Variable>().name.lexeme;
+		this->free.insert(name);
+		this->calls[name]++;
+	}
+	this->cost += 4;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprLogical(Expr::Logical& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprSelect(Expr::Select& expr)
+{
+	expr.condition->accept(*this);
+	expr.if_true->accept(*this);
+	expr.if_false->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	expr.device->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtExpression(Stmt::Expression& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtAsm(Stmt::Asm& stmt)
+{
+	for (const auto& reference : stmt.referenced_variables())
+	{
+		bool write = reference.size() > 1 && reference[1] == '&';
+		std::string name = reference.substr(write ? 2 : 1);
+		this->in_asm.insert(name);
+		if (!this->is_local(name))
+		{
+			this->free.insert(name);
+		}
+		else if (write)
+		{
+			this->written.insert(name);
+		}
+	}
+	const Expr::Literal* str = dynamic_cast<const Expr::Literal*>(stmt.literal.get());
+	if (!str || !str->literal.literal.is_string())
+	{
+		return nullptr;
+	}
+	// labels, jumps and anything touching the stack or ra only work in a function of their own
+	std::istringstream lines(*str->literal.literal.string);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		std::istringstream words(line);
+		std::string word;
+		bool first = true;
+		while (words >> word)
+		{
+			bool branches = first && (word[0] == 'j' || word[0] == 'b');
+			if (branches || word == "sp" || word == "ra" || word.back() == ':')
+			{
+				this->inlinable = false;
+			}
+			if (first)
+			{
+				this->cost++;
+			}
+			first = false;
+		}
+	}
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtVariable(Stmt::Variable& stmt)
+{
+	this->declare(stmt.name.lexeme);
+	stmt.initalizer->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->scopes.emplace_back();
+	for (auto& statement : stmt.statements)
+	{
+		statement->accept(*this);
+	}
+	this->scopes.pop_back();
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.branch_true->accept(*this);
+	this->cost++;
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+		this->cost++;
+	}
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		stmt.value->accept(*this);
+	}
+	this->returns++;
+	this->cost++;
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtWhile(Stmt::While& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.body->accept(*this);
+	this->cost += 2;
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtStatic(Stmt::Static& stmt)
+{
+	// every copy would get its own static
+	this->inlinable = false;
+	return nullptr;
+}
+
+void* FunctionSummary::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	stmt.device->accept(*this);
+	stmt.value->accept(*this);
+	this->cost++;
+	return nullptr;
+}
+
+InlineRenamer::InlineRenamer(Compiler& compiler)
+	:compiler(compiler)
+{
+	this->scopes.emplace_back();
+}
+
+std::string InlineRenamer::declare(const std::string& name)
+{
+	std::string fresh = this->compiler.fresh_name("i" + name);
+	this->scopes.back()[name] = fresh;
+	return fresh;
+}
+
+void InlineRenamer::substitute(const std::string& name, std::shared_ptr<Expr> value)
+{
+	this->substitutions[name] = value;
+}
+
+std::string InlineRenamer::lookup(const std::string& name) const
+{
+	for (auto it = this->scopes.rbegin(); it != this->scopes.rend(); ++it)
+	{
+		const auto& found = it->find(name);
+		if (found != it->end())
+		{
+			return found->second;
+		}
+	}
+	return name;
+}
+
+void InlineRenamer::rename(std::shared_ptr<Expr>& expr)
+{
+	std::unique_ptr<std::shared_ptr<Expr>> replacement(static_cast<std::shared_ptr<Expr>*>(expr->accept(*this)));
+	if (replacement)
+	{
+		expr = *replacement;
+	}
+}
+
+void InlineRenamer::rename(std::unique_ptr<Stmt>& stmt)
+{
+	stmt->accept(*this);
+}
+
+void* InlineRenamer::visitExprBinary(Expr::Binary& expr)
+{
+	this->rename(expr.left);
+	this->rename(expr.right);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprGrouping(Expr::Grouping& expr)
+{
+	this->rename(expr.expression);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprUnary(Expr::Unary& expr)
+{
+	this->rename(expr.right);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprVariable(Expr::Variable& expr)
+{
+	const auto& found = this->substitutions.find(expr.name.lexeme);
+	if (found != this->substitutions.end())
+	{
+		return new std::shared_ptr<Expr>(found->second->clone());
+	}
+	expr.name.lexeme = this->lookup(expr.name.lexeme);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprAssignment(Expr::Assignment& expr)
+{
+	this->rename(expr.value);
+	expr.name.lexeme = this->lookup(expr.name.lexeme);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprCall(Expr::Call& expr)
+{
+	// the callee is a function name, never a local
+	for (auto& arg : expr.arguments)
+	{
+		this->rename(arg);
+	}
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprLogical(Expr::Logical& expr)
+{
+	this->rename(expr.left);
+	this->rename(expr.right);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprSelect(Expr::Select& expr)
+{
+	this->rename(expr.condition);
+	this->rename(expr.if_true);
+	this->rename(expr.if_false);
+	return nullptr;
+}
+
+void* InlineRenamer::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	this->rename(expr.device);
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtExpression(Stmt::Expression& stmt)
+{
+	this->rename(stmt.expression);
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtAsm(Stmt::Asm& stmt)
+{
+	stmt.rename_variables([this](const std::string& name) { return this->lookup(name); });
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtVariable(Stmt::Variable& stmt)
+{
+	stmt.name.lexeme = this->declare(stmt.name.lexeme);
+	this->rename(stmt.initalizer);
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->scopes.emplace_back();
+	for (auto& statement : stmt.statements)
+	{
+		this->rename(statement);
+	}
+	this->scopes.pop_back();
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtIf(Stmt::If& stmt)
+{
+	this->rename(stmt.condition);
+	this->rename(stmt.branch_true);
+	if (stmt.branch_false)
+	{
+		this->rename(stmt.branch_false);
+	}
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		this->rename(stmt.value);
+	}
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtWhile(Stmt::While& stmt)
+{
+	this->rename(stmt.condition);
+	this->rename(stmt.body);
+	return nullptr;
+}
+
+void* InlineRenamer::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	this->rename(stmt.device);
+	this->rename(stmt.value);
+	return nullptr;
+}
+
+Inliner::Inliner(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program), estimate(0), current(nullptr)
+{}
+
+bool Inliner::run()
+{
+	this->call_graph = std::make_unique<CallGraph>(this->program.statements());
+	std::vector<Stmt::Function*> functions;
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			functions.push_back(&stmt->as<Stmt::Function>());
+		}
+	}
+	// jal main, popping its result and jumping back
+	this->estimate = 3;
+	for (Stmt::Function* function : functions)
+	{
+		auto summary = std::make_unique<FunctionSummary>(*function);
+		this->estimate += summary->cost + static_cast<int>(function->params.size()) + function_overhead;
+		for (const auto& call : summary->calls)
+		{
+			if (Stmt::Function* callee = this->call_graph->function(call.first))
+			{
+				this->sites[callee] += call.second;
+			}
+		}
+		this->summaries[function] = std::move(summary);
+	}
+	for (Stmt::Function* function : functions)
+	{
+		this->process(*function);
+	}
+	if (!this->inlined.size())
+	{
+		return false;
+	}
+	this->remove_inlined_functions();
+	return true;
+}
+
+void Inliner::process(Stmt::Function& function)
+{
+	if (this->processed.count(&function))
+	{
+		return;
+	}
+	this->processed.insert(&function);
+	// callees first, so what gets copied has already been inlined into
+	for (Stmt::Function* callee : this->call_graph->callees(function))
+	{
+		this->process(*callee);
+	}
+	this->current = &function;
+	this->inline_into(function.body);
+	this->current = nullptr;
+	this->summaries[&function] = std::make_unique<FunctionSummary>(function);
+}
+
+void Inliner::inline_into(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+	size_t i = 0;
+	while (i < statements.size())
+	{
+		std::unique_ptr<Stmt> replacement(static_cast<Stmt*>(statements[i]->accept(*this)));
+		if (replacement)
+		{
+			statements[i] = std::move(replacement);
+		}
+		if (this->hoisted.size())
+		{
+			std::vector<std::unique_ptr<Stmt>> hoisted = std::move(this->hoisted);
+			this->hoisted.clear();
+			statements.insert(statements.begin() + i, std::make_move_iterator(hoisted.begin()), std::make_move_iterator(hoisted.end()));
+			// the copied body can hold calls of its own, and so can the value that replaced the call
+			continue;
+		}
+		i++;
+	}
+}
+
+void Inliner::inline_branch(std::unique_ptr<Stmt>& branch, const Token& token)
+{
+	std::vector<std::unique_ptr<Stmt>> statements;
+	statements.push_back(std::move(branch));
+	this->inline_into(statements);
+	if (statements.size() == 1)
+	{
+		branch = std::move(statements.back());
+		return;
+	}
+	branch = std::make_unique<Stmt::Block>(std::move(statements), token);
+}
+
+void Inliner::substitute(std::shared_ptr<Expr>& expr)
+{
+	std::unique_ptr<std::shared_ptr<Expr>> replacement(static_cast<std::shared_ptr<Expr>*>(expr->accept(*this)));
+	if (replacement)
+	{
+		expr = *replacement;
+	}
+}
+
+Stmt::Function* Inliner::callee_of(Expr::Call& call) const
+{
+	if (!call.callee->is<Expr::Variable>())
+	{
+		return nullptr;
+	}
+	const Variable* var = this->program.env().root()->get_variable(call.callee->as<Expr::Variable>().name.lexeme);
+	if (!var || !var->full_type().is_function)
+	{
+		return nullptr;
+	}
+	return this->call_graph->function(var->identifier().name());
+}
+
+bool Inliner::can_copy(const Stmt::Function& callee, const FunctionSummary& summary) const
+{
+	if (&callee == this->current || !this->processed.count(&callee) || !summary.inlinable || callee.name.lexeme == "main")
+	{
+		return false;
+	}
+	if (this->call_graph->is_recursive(callee))
+	{
+		return false;
+	}
+	// a local of the caller would hide a static or function the callee uses
+	const FunctionSummary& caller = *this->summaries.at(this->current);
+	for (const auto& name : summary.free)
+	{
+		if (caller.declared.count(name))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Inliner::should_inline(const Stmt::Function& callee, int cost, const Expr::Call& call)
+{
+	int growth = cost - static_cast<int>(call.arguments.size()) - call_overhead;
+	if (this->sites[&callee] == 1)
+	{
+		// the last call is gone, and so is the function
+		growth -= this->summaries.at(&callee)->cost + static_cast<int>(callee.params.size()) + function_overhead;
+	}
+	if (growth > 0 && (cost > max_inline_cost || this->estimate + growth > line_budget))
+	{
+		return false;
+	}
+	this->estimate += growth;
+	return true;
+}
+
+void Inliner::record_inline(const Stmt::Function& callee, const Expr::Call& call)
+{
+	this->inlined.insert(&callee);
+	this->sites[&callee]--;
+	for (const auto& nested : this->summaries.at(&callee)->calls)
+	{
+		if (Stmt::Function* function = this->call_graph->function(nested.first))
+		{
+			this->sites[function] += nested.second;
+		}
+	}
+	this->compiler.info(std::string("Inlined call to ") + callee.name.lexeme + " on line " + std::to_string(call.paren.line));
+}
+
+bool Inliner::hoist(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Call>())
+	{
+		return false;
+	}
+	Expr::Call& call = expr->as<Expr::Call>();
+	Stmt::Function* callee = this->callee_of(call);
+	if (!callee)
+	{
+		return false;
+	}
+	const FunctionSummary& summary = *this->summaries.at(callee);
+	if (!this->can_copy(*callee, summary) || !this->should_inline(*callee, summary.cost + static_cast<int>(callee->params.size()), call))
+	{
+		return false;
+	}
+	this->record_inline(*callee, call);
+
+	InlineRenamer renamer(this->compiler);
+	for (size_t i = 0; i < callee->params.size(); i++)
+	{
+		const Stmt::Function::Param& param = callee->params[i];
+		TypeName type = param.type;
+		// a literal argument becomes a fixed local, which the optimizer substitutes at every read it visits
+		if (call.arguments[i]->is<Expr::Literal>() && !summary.written.count(param.name.lexeme) && !summary.in_asm.count(param.name.lexeme))
+		{
+			type.compile_time = true;
+		}
+		Token name(call.paren.line, TokenType::IDENTIFIER, renamer.declare(param.name.lexeme));
+		this->hoisted.push_back(std::make_unique<Stmt::Variable>(type, name, call.arguments[i]));
+	}
+	for (size_t i = 0; i + 1 < callee->body.size(); i++)
+	{
+		std::unique_ptr<Stmt> copy = callee->body[i]->clone();
+		renamer.rename(copy);
+		this->hoisted.push_back(std::move(copy));
+	}
+	std::shared_ptr<Expr> value = callee->body.back()->as<Stmt::Return>().value;
+	if (!value)
+	{
+		expr = nullptr;
+		return true;
+	}
+	expr = value->clone();
+	renamer.rename(expr);
+	return true;
+}
+
+void Inliner::remove_inlined_functions()
+{
+	std::vector<std::unique_ptr<Stmt>>& statements = this->program.statements();
+	bool removed = true;
+	while (removed)
+	{
+		removed = false;
+		CallGraph graph(statements);
+		std::unordered_set<const Stmt::Function*> called;
+		for (auto& stmt : statements)
+		{
+			if (stmt->is<Stmt::Function>())
+			{
+				for (const Stmt::Function* callee : graph.callees(stmt->as<Stmt::Function>()))
+				{
+					if (callee != stmt.get())
+					{
+						called.insert(callee);
+					}
+				}
+			}
+		}
+		for (auto it = statements.begin(); it != statements.end(); ++it)
+		{
+			Stmt::Function* function = (*it)->is<Stmt::Function>() ? &(*it)->as<Stmt::Function>() : nullptr;
+			if (function && this->inlined.count(function) && !called.count(function))
+			{
+				this->compiler.info(std::string("Removed ") + function->name.lexeme + ", every call to it was inlined");
+				this->inlined.erase(function);
+				statements.erase(it);
+				removed = true;
+				break;
+			}
+		}
+	}
+}
+
+void* Inliner::visitExprBinary(Expr::Binary& expr)
+{
+	this->substitute(expr.left);
+	this->substitute(expr.right);
+	return nullptr;
+}
+
+void* Inliner::visitExprGrouping(Expr::Grouping& expr)
+{
+	this->substitute(expr.expression);
+	return nullptr;
+}
+
+void* Inliner::visitExprUnary(Expr::Unary& expr)
+{
+	this->substitute(expr.right);
+	return nullptr;
+}
+
+void* Inliner::visitExprAssignment(Expr::Assignment& expr)
+{
+	this->substitute(expr.value);
+	return nullptr;
+}
+
+void* Inliner::visitExprCall(Expr::Call& expr)
+{
+	for (auto& arg : expr.arguments)
+	{
+		this->substitute(arg);
+	}
+	Stmt::Function* callee = this->callee_of(expr);
+	if (!callee)
+	{
+		return nullptr;
+	}
+	const FunctionSummary& summary = *this->summaries.at(callee);
+	if (!summary.value || summary.written.size() || !this->can_copy(*callee, summary))
+	{
+		return nullptr;
+	}
+	// arguments are read where the parameters were, which is only the same value if nothing can change them in between
+	const FunctionSummary& caller = *this->summaries.at(this->current);
+	for (const auto& arg : expr.arguments)
+	{
+		bool local = arg->is<Expr::Variable>() && caller.declared.count(arg->as<Expr::Variable>().name.lexeme);
+		bool constant = arg->is<Expr::Literal>() || (arg->is<Expr::Variable>() && summary.calls.empty());
+		if (!local && !constant)
+		{
+			return nullptr;
+		}
+	}
+	if (!this->should_inline(*callee, summary.cost, expr))
+	{
+		return nullptr;
+	}
+	this->record_inline(*callee, expr);
+
+	InlineRenamer renamer(this->compiler);
+	for (size_t i = 0; i < callee->params.size(); i++)
+	{
+		renamer.substitute(callee->params[i].name.lexeme, expr.arguments[i]);
+	}
+	std::shared_ptr<Expr> value = summary.value->clone();
+	renamer.rename(value);
+	return new std::shared_ptr<Expr>(value);
+}
+
+void* Inliner::visitExprLogical(Expr::Logical& expr)
+{
+	this->substitute(expr.left);
+	this->substitute(expr.right);
+	return nullptr;
+}
+
+void* Inliner::visitExprSelect(Expr::Select& expr)
+{
+	this->substitute(expr.condition);
+	this->substitute(expr.if_true);
+	this->substitute(expr.if_false);
+	return nullptr;
+}
+
+void* Inliner::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	this->substitute(expr.device);
+	return nullptr;
+}
+
+void* Inliner::visitStmtExpression(Stmt::Expression& stmt)
+{
+	this->substitute(stmt.expression);
+	if (stmt.expression->is<Expr::Assignment>())
+	{
+		this->hoist(stmt.expression->as<Expr::Assignment>().value);
+		return nullptr;
+	}
+	if (this->hoist(stmt.expression) && (!stmt.expression || stmt.expression->is<Expr::Literal>() || stmt.expression->is<Expr::Variable>()))
+	{
+		// the returned value is thrown away
+		return new Stmt::NoOp();
+	}
+	return nullptr;
+}
+
+void* Inliner::visitStmtVariable(Stmt::Variable& stmt)
+{
+	this->substitute(stmt.initalizer);
+	this->hoist(stmt.initalizer);
+	return nullptr;
+}
+
+void* Inliner::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->inline_into(stmt.statements);
+	return nullptr;
+}
+
+void* Inliner::visitStmtIf(Stmt::If& stmt)
+{
+	this->substitute(stmt.condition);
+	this->inline_branch(stmt.branch_true, stmt.token);
+	if (stmt.branch_false)
+	{
+		this->inline_branch(stmt.branch_false, stmt.token);
+	}
+	return nullptr;
+}
+
+void* Inliner::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		this->substitute(stmt.value);
+		this->hoist(stmt.value);
+	}
+	return nullptr;
+}
+
+void* Inliner::visitStmtWhile(Stmt::While& stmt)
+{
+	// the condition runs on every iteration, so only a substituted value can stay in it
+	this->substitute(stmt.condition);
+	this->inline_branch(stmt.body, stmt.token);
+	return nullptr;
+}
+
+void* Inliner::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	this->substitute(stmt.device);
+	this->substitute(stmt.value);
+	// the device is evaluated first, a copied body may not run before it unless that cannot matter
+	if (stmt.device->is<Expr::Literal>() || (stmt.device->is<Expr::Variable>() && this->summaries.at(this->current)->declared.count(stmt.device->as<Expr::Variable>().name.lexeme)))
+	{
+		this->hoist(stmt.value);
+	}
+	return nullptr;
+}
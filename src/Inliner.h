@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AST.h"
+#include "CallGraph.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// What the inliner needs to know about the body of a function.
+class FunctionSummary : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	explicit FunctionSummary(Stmt::Function& function);
+
+	// roughly the number of lines the body generates
+	int cost;
+	// the body ends in its only return and does nothing that depends on its own frame
+	bool inlinable;
+	// set when the body is a single return, so calls can be replaced by the returned value
+	std::shared_ptr<Expr> value;
+	// parameters and locals, written ones are assigned or written by asm
+	std::unordered_set<std::string> declared;
+	std::unordered_set<std::string> written;
+	std::unordered_set<std::string> in_asm;
+	// statics and functions, which have to mean the same thing in the caller
+	std::unordered_set<std::string> free;
+	// call sites by callee name
+	std::unordered_map<std::string, int> calls;
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprVariable(Expr::Variable& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtStatic(Stmt::Static& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	void declare(const std::string& name);
+	bool is_local(const std::string& name) const;
+
+	std::vector<std::unordered_set<std::string>> scopes;
+	int returns;
+};
+
+// Renames the locals of a copied body so they cannot clash with the caller's.
+// Parameters can instead be substituted by the expressions they were called with.
+class InlineRenamer : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	explicit InlineRenamer(Compiler& compiler);
+
+	std::string declare(const std::string& name);
+	void substitute(const std::string& name, std::shared_ptr<Expr> value);
+	void rename(std::shared_ptr<Expr>& expr);
+	void rename(std::unique_ptr<Stmt>& stmt);
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprVariable(Expr::Variable& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	std::string lookup(const std::string& name) const;
+
+	Compiler& compiler;
+	std::vector<std::unordered_map<std::string, std::string>> scopes;
+	std::unordered_map<std::string, std::shared_ptr<Expr>> substitutions;
+};
+
+// Copies the bodies of small functions into their callers.
+// A call whose callee is a single return is replaced by the returned expression, any other call
+// that is the whole value of its statement gets the callee's body placed in front of the statement.
+// Works on a checked program, which has to be checked again once anything was inlined.
+class Inliner : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	Inliner(Compiler& compiler, TypeCheckedProgram& program);
+
+	// returns whether anything was inlined
+	bool run();
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	// an IC10 chip holds no more lines than this
+	static constexpr int line_budget = 128;
+	// bodies above this are only inlined when that makes the program smaller
+	static constexpr int max_inline_cost = 12;
+	// jal, the return value and saving registers around the call
+	static constexpr int call_overhead = 4;
+	// saving ra, reloading it, popping the frame, pushing the result and jumping back
+	static constexpr int function_overhead = 5;
+
+	void process(Stmt::Function& function);
+	void inline_into(std::vector<std::unique_ptr<Stmt>>& statements);
+	void inline_branch(std::unique_ptr<Stmt>& branch, const Token& token);
+	void substitute(std::shared_ptr<Expr>& expr);
+	bool hoist(std::shared_ptr<Expr>& expr);
+
+	Stmt::Function* callee_of(Expr::Call& call) const;
+	bool can_copy(const Stmt::Function& callee, const FunctionSummary& summary) const;
+	bool should_inline(const Stmt::Function& callee, int cost, const Expr::Call& call);
+	void record_inline(const Stmt::Function& callee, const Expr::Call& call);
+	void remove_inlined_functions();
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	std::unique_ptr<CallGraph> call_graph;
+	std::unordered_map<const Stmt::Function*, std::unique_ptr<FunctionSummary>> summaries;
+	std::unordered_set<const Stmt::Function*> processed;
+	std::unordered_set<const Stmt::Function*> inlined;
+	// call sites left for every function
+	std::unordered_map<const Stmt::Function*, int> sites;
+	// lines the whole program is expected to take
+	int estimate;
+
+	Stmt::Function* current;
+	// statements that have to run before the statement being visited
+	std::vector<std::unique_ptr<Stmt>> hoisted;
+};
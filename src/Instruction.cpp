@@ -0,0 +1,301 @@
+#include "Instruction.h"
+
+#include <stdexcept>
+
+Operand Operand::reg(int index)
+{
+	Operand operand(Kind::Register);
+	operand.index = index;
+	return operand;
+}
+
+Operand Operand::number(double value)
+{
+	Operand operand(Kind::Number);
+	operand.value = value;
+	return operand;
+}
+
+Operand Operand::literal(const Literal& value)
+{
+	if (value.is_number())
+	{
+		return Operand::number(value.as_number());
+	}
+	if (value.is_boolean())
+	{
+		return Operand::number(value.as_boolean() ? 1.0 : 0.0);
+	}
+	return Operand::text(value.to_value_string());
+}
+
+Operand Operand::label(LabelId label)
+{
+	Operand operand(Kind::Label);
+	operand.index = label;
+	return operand;
+}
+
+Operand Operand::device(int index)
+{
+	Operand operand(Kind::Device);
+	operand.value = index;
+	return operand;
+}
+
+Operand Operand::device_register(int index)
+{
+	Operand operand(Kind::DeviceRegister);
+	operand.index = index;
+	return operand;
+}
+
+Operand Operand::text(const std::string& value)
+{
+	Operand operand(Kind::Text);
+	operand.name = value;
+	return operand;
+}
+
+bool Operand::is_register() const
+{
+	return this->kind == Kind::Register;
+}
+
+bool Operand::is_register(int index) const
+{
+	return this->kind == Kind::Register && index >= 0 && this->index == static_cast<size_t>(index);
+}
+
+bool Operand::operator==(const Operand& other) const
+{
+	if (this->kind != other.kind)
+	{
+		return false;
+	}
+	switch (this->kind)
+	{
+	case Kind::Register:
+	case Kind::Label:
+	case Kind::DeviceRegister:
+		return this->index == other.index;
+	case Kind::Number:
+	case Kind::Device:
+		return this->value == other.value;
+	case Kind::Text:
+		return this->name == other.name;
+	}
+	return false;
+}
+
+bool Operand::operator!=(const Operand& other) const
+{
+	return !(*this == other);
+}
+
+std::string Operand::to_string() const
+{
+	switch (this->kind)
+	{
+	case Kind::Register:
+		if (this->index == registers::sp)
+		{
+			return "sp";
+		}
+		if (this->index == registers::ra)
+		{
+			return "ra";
+		}
+		return std::string("r") + std::to_string(this->index);
+	case Kind::Number:
+		return Literal(this->value).to_value_string();
+	case Kind::Device:
+		if (this->value == -1)
+		{
+			return "db";
+		}
+		return std::string("d") + std::to_string(static_cast<int>(this->value));
+	case Kind::DeviceRegister:
+		return std::string("dr") + std::to_string(this->index);
+	case Kind::Text:
+		return this->name;
+	case Kind::Label:
+		throw std::logic_error("Labels must be resolved by the instruction buffer.");
+	}
+	throw std::logic_error("Operand had invalid kind.");
+}
+
+const char* Instruction::mnemonic(Opcode opcode)
+{
+	switch (opcode)
+	{
+	case Opcode::Move: return "move";
+	case Opcode::Add: return "add";
+	case Opcode::Sub: return "sub";
+	case Opcode::Mul: return "mul";
+	case Opcode::Div: return "div";
+	case Opcode::Min: return "min";
+	case Opcode::Max: return "max";
+	case Opcode::Slt: return "slt";
+	case Opcode::Sgt: return "sgt";
+	case Opcode::Sle: return "sle";
+	case Opcode::Sge: return "sge";
+	case Opcode::Seq: return "seq";
+	case Opcode::Sne: return "sne";
+	case Opcode::Seqz: return "seqz";
+	case Opcode::Select: return "select";
+	case Opcode::Push: return "push";
+	case Opcode::Pop: return "pop";
+	case Opcode::Peek: return "peek";
+	case Opcode::Load: return "l";
+	case Opcode::Store: return "s";
+	case Opcode::Jump: return "j";
+	case Opcode::JumpRelative: return "jr";
+	case Opcode::JumpAndLink: return "jal";
+	case Opcode::BranchEqualZero: return "breqz";
+	case Opcode::BranchNotEqualZero: return "brnez";
+	case Opcode::BranchLessEqualZero: return "brlez";
+	case Opcode::BranchEqual: return "breq";
+	case Opcode::BranchNotEqual: return "brne";
+	case Opcode::BranchLessThan: return "brlt";
+	case Opcode::BranchLessEqual: return "brle";
+	case Opcode::BranchGreaterThan: return "brgt";
+	case Opcode::BranchGreaterEqual: return "brge";
+	case Opcode::Label:
+	case Opcode::Comment:
+	case Opcode::Raw:
+		break;
+	}
+	throw std::logic_error("Pseudo instruction has no mnemonic.");
+}
+
+bool Instruction::occupies_line() const
+{
+	return this->opcode != Opcode::Label;
+}
+
+bool Instruction::is_relative_jump() const
+{
+	return this->opcode == Opcode::JumpRelative || this->is_branch();
+}
+
+bool Instruction::is_branch() const
+{
+	switch (this->opcode)
+	{
+	case Opcode::BranchEqualZero:
+	case Opcode::BranchNotEqualZero:
+	case Opcode::BranchLessEqualZero:
+	case Opcode::BranchEqual:
+	case Opcode::BranchNotEqual:
+	case Opcode::BranchLessThan:
+	case Opcode::BranchLessEqual:
+	case Opcode::BranchGreaterThan:
+	case Opcode::BranchGreaterEqual:
+		return true;
+	default:
+		return false;
+	}
+}
+
+InstructionBuffer::InstructionBuffer()
+{}
+
+LabelId InstructionBuffer::create_label()
+{
+	this->label_names.push_back("");
+	return this->label_names.size() - 1;
+}
+
+LabelId InstructionBuffer::named_label(const std::string& name)
+{
+	const auto& existing = this->named_labels.find(name);
+	if (existing != this->named_labels.end())
+	{
+		return existing->second;
+	}
+	LabelId label = this->create_label();
+	this->label_names[label] = name;
+	this->named_labels.emplace(name, label);
+	return label;
+}
+
+void InstructionBuffer::place_label(LabelId label, int source_line)
+{
+	this->emit(Instruction(Opcode::Label, { Operand::label(label) }, source_line));
+}
+
+void InstructionBuffer::emit(Instruction instruction)
+{
+	this->m_instructions.push_back(std::move(instruction));
+}
+
+std::vector<Instruction>& InstructionBuffer::instructions()
+{
+	return this->m_instructions;
+}
+
+const std::vector<Instruction>& InstructionBuffer::instructions() const
+{
+	return this->m_instructions;
+}
+
+std::vector<int> InstructionBuffer::label_lines() const
+{
+	std::vector<int> lines(this->label_names.size(), -1);
+	int line = 0;
+	for (const auto& instruction : this->m_instructions)
+	{
+		if (instruction.opcode == Opcode::Label)
+		{
+			lines[instruction.operands[0].index] = line;
+			continue;
+		}
+		line++;
+	}
+	return lines;
+}
+
+std::string InstructionBuffer::serialize() const
+{
+	std::vector<int> lines = this->label_lines();
+	std::string code;
+	int line = 0;
+	for (const auto& instruction : this->m_instructions)
+	{
+		switch (instruction.opcode)
+		{
+		case Opcode::Label:
+			continue;
+		case Opcode::Comment:
+			code += "#";
+			code += instruction.text;
+			break;
+		case Opcode::Raw:
+			code += instruction.text;
+			break;
+		default:
+			code += Instruction::mnemonic(instruction.opcode);
+			for (const auto& operand : instruction.operands)
+			{
+				code += " ";
+				if (operand.kind != Operand::Kind::Label)
+				{
+					code += operand.to_string();
+					continue;
+				}
+				int target = lines[operand.index];
+				if (target == -1)
+				{
+					const std::string& name = this->label_names[operand.index];
+					throw std::runtime_error(std::string("Attempted to reference undefined label ") + (name.empty() ? std::to_string(operand.index) : name));
+				}
+				code += std::to_string(instruction.is_relative_jump() ? target - line : target);
+			}
+			break;
+		}
+		code += "\n";
+		line++;
+	}
+	return code;
+}
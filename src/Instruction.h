@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Token.h"
+
+enum class Opcode
+{
+	// pseudo instructions, a label emits no line and marks a jump target
+	Label,
+	Comment,
+	Raw,
+
+	Move,
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Min,
+	Max,
+	Slt,
+	Sgt,
+	Sle,
+	Sge,
+	Seq,
+	Sne,
+	Seqz,
+	Select,
+
+	Push,
+	Pop,
+	Peek,
+
+	Load,
+	Store,
+
+	Jump,
+	JumpRelative,
+	JumpAndLink,
+	BranchEqualZero,
+	BranchNotEqualZero,
+	BranchLessEqualZero,
+	// compare two values and branch, the target is the last operand
+	BranchEqual,
+	BranchNotEqual,
+	BranchLessThan,
+	BranchLessEqual,
+	BranchGreaterThan,
+	BranchGreaterEqual,
+};
+
+typedef size_t LabelId;
+
+namespace registers
+{
+	constexpr int sp = 16;
+	constexpr int ra = 17;
+}
+
+struct Operand
+{
+	enum class Kind
+	{
+		Register,
+		Number,
+		Label,
+		Device,
+		DeviceRegister,
+		Text,
+	};
+
+	static Operand reg(int index);
+	static Operand number(double value);
+	static Operand literal(const Literal& value);
+	static Operand label(LabelId label);
+	static Operand device(int index);
+	static Operand device_register(int index);
+	static Operand text(const std::string& value);
+
+	bool is_register() const;
+	bool is_register(int index) const;
+	bool operator==(const Operand& other) const;
+	bool operator!=(const Operand& other) const;
+
+	std::string to_string() const;
+
+	Kind kind;
+	// register index, device index, or label id depending on kind
+	size_t index;
+	double value;
+	std::string name;
+private:
+	Operand(Kind kind) :kind(kind), index(0), value(0.0) {};
+};
+
+struct Instruction
+{
+	Instruction(Opcode opcode, std::vector<Operand> operands, int source_line) :opcode(opcode), operands(std::move(operands)), source_line(source_line) {};
+	Instruction(Opcode opcode, const std::string& text, int source_line) :opcode(opcode), text(text), source_line(source_line) {};
+
+	static const char* mnemonic(Opcode opcode);
+
+	// false only for labels, every other instruction occupies exactly one line of output
+	bool occupies_line() const;
+	bool is_relative_jump() const;
+	// conditional, falls through to the next line when not taken
+	bool is_branch() const;
+
+	Opcode opcode;
+	std::vector<Operand> operands;
+	// comment or verbatim asm text
+	std::string text;
+	int source_line;
+};
+
+class InstructionBuffer
+{
+public:
+	InstructionBuffer();
+
+	LabelId create_label();
+	LabelId named_label(const std::string& name);
+	void place_label(LabelId label, int source_line);
+
+	void emit(Instruction instruction);
+
+	std::vector<Instruction>& instructions();
+	const std::vector<Instruction>& instructions() const;
+
+	std::string serialize() const;
+private:
+	std::vector<int> label_lines() const;
+
+	std::vector<Instruction> m_instructions;
+	std::vector<std::string> label_names;
+	std::unordered_map<std::string, LabelId> named_labels;
+};
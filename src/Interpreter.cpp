@@ -1,10 +1,72 @@
 #include "Interpreter.h"
 
+Interpreter::Interpreter(const CallGraph& call_graph, int step_budget)
+	:call_graph(call_graph), steps_left(step_budget), returning(false)
+{}
+
+Literal* Interpreter::call(Stmt::Function& function, const std::vector<Literal>& arguments)
+{
+	if (this->frames.size() >= max_depth)
+	{
+		throw Unevaluable("Calls nest too deeply.");
+	}
+	if (arguments.size() != function.params.size())
+	{
+		throw Unevaluable(std::string("Wrong number of arguments to ") + function.name.lexeme + ".");
+	}
+	this->frames.emplace_back();
+	this->frames.back().emplace_back();
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		this->frames.back().back().emplace(function.params[i].name.lexeme, arguments[i]);
+	}
+	for (auto& stmt : function.body)
+	{
+		this->execute(*stmt);
+		if (this->returning)
+		{
+			break;
+		}
+	}
+	this->frames.pop_back();
+	this->returning = false;
+	return this->returned.release();
+}
+
 Literal* Interpreter::evaluate(Expr& expression)
 {
+	this->step();
 	return static_cast<Literal*>(expression.accept(*this));
 }
 
+void Interpreter::execute(Stmt& stmt)
+{
+	this->step();
+	stmt.accept(*this);
+}
+
+void Interpreter::step()
+{
+	if (--this->steps_left < 0)
+	{
+		throw Unevaluable("Ran out of steps.");
+	}
+}
+
+Literal& Interpreter::lookup(const std::string& name)
+{
+	std::vector<Scope>& scopes = this->frames.back();
+	for (auto it = scopes.rbegin(); it != scopes.rend(); it++)
+	{
+		const auto& found = it->find(name);
+		if (found != it->end())
+		{
+			return found->second;
+		}
+	}
+	throw Unevaluable(std::string("Reads ") + name + ", which is not a local.");
+}
+
 bool Interpreter::is_truthy(Literal& value)
 {
 	if (value.boolean)
@@ -111,22 +173,82 @@ void* Interpreter::visitExprBinary(Expr::Binary& expr)
 		delete right;
 		return result;
 	}
+	default:
+		break;
 	}
-	return nullptr;
+	delete left;
+	delete right;
+	throw Unevaluable("Unsupported binary operation.");
 }
 
 void* Interpreter::visitExprVariable(Expr::Variable& expr)
 {
-	return new Literal(42.0);
+	return new Literal(this->lookup(expr.name.lexeme));
 }
 
 void* Interpreter::visitExprAssignment(Expr::Assignment& expr)
 {
 	Literal* value = this->evaluate(*expr.value);
-	// assign
+	Literal& target = this->lookup(expr.name.lexeme);
+	target = *value;
 	return value;
 }
 
+void* Interpreter::visitExprCall(Expr::Call& expr)
+{
+	Stmt::Function* function = expr.callee->is<Expr::Variable>() ? this->call_graph.function(expr.callee->as<Expr::Variable>().name.lexeme) : nullptr;
+	if (!function)
+	{
+		throw Unevaluable("Calls an unknown function.");
+	}
+	std::vector<Literal> arguments;
+	for (auto& arg : expr.arguments)
+	{
+		std::unique_ptr<Literal> value(this->evaluate(*arg));
+		arguments.push_back(*value);
+	}
+	Literal* result = this->call(*function, arguments);
+	if (!result)
+	{
+		throw Unevaluable(std::string("Uses the value of ") + function->name.lexeme + ", which returns nothing.");
+	}
+	return result;
+}
+
+void* Interpreter::visitExprLogical(Expr::Logical& expr)
+{
+	std::unique_ptr<Literal> left(this->evaluate(*expr.left));
+	switch (expr.op.type)
+	{
+	case TokenType::AND:
+		if (!this->is_truthy(*left))
+		{
+			return left.release();
+		}
+		break;
+	case TokenType::OR:
+		if (this->is_truthy(*left))
+		{
+			return left.release();
+		}
+		break;
+	default:
+		throw Unevaluable("Unsupported logical operation.");
+	}
+	return this->evaluate(*expr.right);
+}
+
+void* Interpreter::visitExprSelect(Expr::Select& expr)
+{
+	std::unique_ptr<Literal> condition(this->evaluate(*expr.condition));
+	return this->evaluate(this->is_truthy(*condition) ? *expr.if_true : *expr.if_false);
+}
+
+void* Interpreter::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	throw Unevaluable("Reads from a device.");
+}
+
 void* Interpreter::visitExprGrouping(Expr::Grouping& expr)
 {
 	return this->evaluate(*expr.expression);
@@ -144,18 +266,21 @@ void* Interpreter::visitExprUnary(Expr::Unary& expr)
 	{
 	case TokenType::BANG:
 	{
-		bool truthy = this->is_truthy(*right);
+		// ! takes a number and gives 1 for zero and 0 for anything else
+		Literal* result = right->number ? new Literal(*right->number == 0 ? 1.0 : 0.0) : new Literal(!this->is_truthy(*right));
 		delete right;
-		right = new Literal(truthy);
-		return right;
+		return result;
 	}
 	case TokenType::MINUS:
 	{
 		(*right->number) *= -1;
 		return right;
 	}
+	default:
+		break;
 	}
-	return nullptr;
+	delete right;
+	throw Unevaluable("Unsupported unary operation.");
 }
 
 void* Interpreter::visitStmtExpression(Stmt::Expression& stmt)
@@ -166,8 +291,7 @@ void* Interpreter::visitStmtExpression(Stmt::Expression& stmt)
 
 void* Interpreter::visitStmtAsm(Stmt::Asm& stmt)
 {
-	// TODO
-	return nullptr;
+	throw Unevaluable("Runs asm.");
 }
 
 void* Interpreter::visitStmtPrint(Stmt::Print& stmt)
@@ -177,3 +301,78 @@ void* Interpreter::visitStmtPrint(Stmt::Print& stmt)
 	delete literal;
 	return nullptr;
 }
+
+void* Interpreter::visitStmtVariable(Stmt::Variable& stmt)
+{
+	std::unique_ptr<Literal> value(this->evaluate(*stmt.initalizer));
+	this->frames.back().back()[stmt.name.lexeme] = *value;
+	return nullptr;
+}
+
+void* Interpreter::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->frames.back().emplace_back();
+	for (auto& statement : stmt.statements)
+	{
+		this->execute(*statement);
+		if (this->returning)
+		{
+			break;
+		}
+	}
+	this->frames.back().pop_back();
+	return nullptr;
+}
+
+void* Interpreter::visitStmtIf(Stmt::If& stmt)
+{
+	std::unique_ptr<Literal> condition(this->evaluate(*stmt.condition));
+	if (this->is_truthy(*condition))
+	{
+		this->execute(*stmt.branch_true);
+	}
+	else if (stmt.branch_false)
+	{
+		this->execute(*stmt.branch_false);
+	}
+	return nullptr;
+}
+
+void* Interpreter::visitStmtFunction(Stmt::Function& stmt)
+{
+	throw std::logic_error("Functions cannot be nested.");
+}
+
+void* Interpreter::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		this->returned.reset(this->evaluate(*stmt.value));
+	}
+	this->returning = true;
+	return nullptr;
+}
+
+void* Interpreter::visitStmtWhile(Stmt::While& stmt)
+{
+	while (!this->returning)
+	{
+		std::unique_ptr<Literal> condition(this->evaluate(*stmt.condition));
+		if (!this->is_truthy(*condition))
+		{
+			break;
+		}
+		this->execute(*stmt.body);
+	}
+	return nullptr;
+}
+
+void* Interpreter::visitStmtStatic(Stmt::Static& stmt)
+{
+	throw Unevaluable("Declares a static.");
+}
+
+void* Interpreter::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	throw Unevaluable("Writes to a device.");
+}
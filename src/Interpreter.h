@@ -1,13 +1,31 @@
 #pragma once
 
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 #include "AST.h"
+#include "CallGraph.h"
 
+// Runs functions at compile time.
+// Only locals, literals and calls to known functions can be evaluated, anything that touches
+// the outside world, or takes more steps than it was given, throws Interpreter::Unevaluable.
 class Interpreter : public Expr::Visitor, public Stmt::Visitor
 {
 public:
+	class Unevaluable : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	Interpreter(const CallGraph& call_graph, int step_budget);
+
+	// returns nullptr when the function returns nothing
+	Literal* call(Stmt::Function& function, const std::vector<Literal>& arguments);
 	Literal* evaluate(Expr& expression);
+	void execute(Stmt& stmt);
 	bool is_truthy(Literal& value);
 	bool is_equal(Literal& a, Literal& b);
 
@@ -17,11 +35,35 @@ public:
 	virtual void* visitExprUnary(Expr::Unary& expr) override;
 	virtual void* visitExprVariable(Expr::Variable& expr) override;
 	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
 
 	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
 	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
 	virtual void* visitStmtPrint(Stmt::Print& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtFunction(Stmt::Function& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtStatic(Stmt::Static& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
 private:
+	// deep enough for any recursion that fits in the step budget of a small program
+	static constexpr int max_depth = 200;
 
-};
+	using Scope = std::unordered_map<std::string, Literal>;
 
+	void step();
+	Literal& lookup(const std::string& name);
+
+	const CallGraph& call_graph;
+	int steps_left;
+	// the scopes of every active call, innermost last
+	std::vector<std::vector<Scope>> frames;
+	std::unique_ptr<Literal> returned;
+	bool returning;
+};
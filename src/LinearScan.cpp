@@ -0,0 +1,409 @@
+#include <algorithm>
+
+#include "LinearScan.h"
+
+LinearScan::LinearScan(TypeCheckedProgram& program, Stmt::Function& function)
+	:program(program), position(1)
+{
+	TypedEnvironment::Leaf* function_env = this->program.env().root()->enter(&function);
+	for (const auto& param : function.params)
+	{
+		const Variable* var = function_env ? function_env->get_variable(param.name.lexeme) : nullptr;
+		SymbolTable::Index symbol = var ? this->program.table.lookup_variable_index(var) : SymbolTable::Invalid;
+		this->parameters.push_back(symbol);
+		// parameters are already on the stack when the function is entered
+		this->begin_interval(symbol, 0, nullptr);
+	}
+	for (auto& stmt : function.body)
+	{
+		stmt->accept(*this);
+	}
+	this->finish_intervals();
+}
+
+void LinearScan::number(const void* node)
+{
+	this->positions[node] = this->position++;
+}
+
+void LinearScan::begin_interval(SymbolTable::Index symbol, int start, const void* node)
+{
+	if (symbol == SymbolTable::Invalid || this->symbol_to_interval.count(symbol))
+	{
+		return;
+	}
+	this->symbol_to_interval.emplace(symbol, this->intervals.size());
+	this->intervals.push_back(Interval{ symbol, start, start, node, NoRegister, {} });
+}
+
+void LinearScan::use(const void* node)
+{
+	const auto& found = this->symbol_to_interval.find(this->program.table.lookup_index(node));
+	if (found == this->symbol_to_interval.end())
+	{
+		// statics and anything defined outside of this function
+		return;
+	}
+	Interval& interval = this->intervals[found->second];
+	interval.uses.push_back(this->positions.at(node));
+	for (auto& loop : this->loops)
+	{
+		if (interval.start < loop.start)
+		{
+			// the next iteration reads it again, so it is extended once the loop is done
+			loop.extended.push_back(interval.symbol);
+			return;
+		}
+	}
+	this->extend(interval.symbol, this->positions.at(node), node);
+}
+
+void LinearScan::extend(SymbolTable::Index symbol, int position, const void* node)
+{
+	Interval& interval = this->intervals[this->symbol_to_interval.at(symbol)];
+	if (position >= interval.end)
+	{
+		interval.end = position;
+		interval.end_node = node;
+	}
+}
+
+void LinearScan::finish_intervals()
+{
+	// the symbol table also records uses the walk cannot see, such as asm references
+	for (auto& interval : this->intervals)
+	{
+		Symbol& symbol = this->program.table.lookup(interval.symbol);
+		SymbolUseNode ending = symbol.ending();
+		if (ending.id() == symbol.beginning().id())
+		{
+			continue;
+		}
+		const auto& found = this->positions.find(ending.id());
+		if (found == this->positions.end())
+		{
+			// last use was removed or moved by the optimizer, keep it alive until the function returns
+			interval.end = this->position;
+			interval.end_node = nullptr;
+			continue;
+		}
+		this->extend(interval.symbol, found->second, ending.id());
+	}
+}
+
+void LinearScan::precolor_parameter(size_t index, int reg)
+{
+	const auto& found = this->symbol_to_interval.find(this->parameters.at(index));
+	if (found == this->symbol_to_interval.end())
+	{
+		return;
+	}
+	this->intervals[found->second].reg = reg;
+}
+
+void LinearScan::allocate(const std::vector<int>& pool)
+{
+	std::vector<size_t> order;
+	order.reserve(this->intervals.size());
+	for (size_t i = 0; i < this->intervals.size(); i++)
+	{
+		const Interval& interval = this->intervals[i];
+		// parameters that are never read stay on the stack
+		if (interval.start == interval.end && !interval.end_node)
+		{
+			continue;
+		}
+		if (interval.reg != NoRegister)
+		{
+			continue;
+		}
+		order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return this->intervals[a].start < this->intervals[b].start; });
+
+	// the last free register is handed out first, so the pool is reversed
+	std::vector<int> free_registers(pool.rbegin(), pool.rend());
+	// sorted by increasing end
+	std::vector<size_t> active;
+	auto activate = [this, &active](size_t index)
+	{
+		auto it = std::upper_bound(active.begin(), active.end(), index, [this](size_t a, size_t b) { return this->intervals[a].end < this->intervals[b].end; });
+		active.insert(it, index);
+	};
+	for (size_t index : order)
+	{
+		Interval& interval = this->intervals[index];
+		while (active.size() && this->intervals[active.front()].end < interval.start)
+		{
+			free_registers.push_back(this->intervals[active.front()].reg);
+			active.erase(active.begin());
+		}
+		if (free_registers.size())
+		{
+			interval.reg = free_registers.back();
+			free_registers.pop_back();
+			activate(index);
+			continue;
+		}
+		if (!active.size())
+		{
+			continue;
+		}
+		// out of registers, whichever interval ends last goes to the stack
+		Interval& furthest = this->intervals[active.back()];
+		if (furthest.end > interval.end)
+		{
+			interval.reg = furthest.reg;
+			furthest.reg = NoRegister;
+			active.pop_back();
+			activate(index);
+		}
+	}
+
+	for (const auto& interval : this->intervals)
+	{
+		if (interval.end_node)
+		{
+			this->endings[interval.end_node].push_back(interval.symbol);
+		}
+	}
+}
+
+int LinearScan::register_of(SymbolTable::Index symbol) const
+{
+	const auto& found = this->symbol_to_interval.find(symbol);
+	if (found == this->symbol_to_interval.end())
+	{
+		return NoRegister;
+	}
+	return this->intervals[found->second].reg;
+}
+
+int LinearScan::register_of_definition(Stmt::Variable& stmt)
+{
+	return this->register_of(this->program.table.lookup_index(stmt.downcast()));
+}
+
+int LinearScan::register_of_parameter(size_t index) const
+{
+	return this->register_of(this->parameters.at(index));
+}
+
+SymbolTable::Index LinearScan::parameter_symbol(size_t index) const
+{
+	return this->parameters.at(index);
+}
+
+bool LinearScan::live_after(SymbolTable::Index symbol, const void* node) const
+{
+	const auto& found = this->symbol_to_interval.find(symbol);
+	const auto& position = this->positions.find(node);
+	if (found == this->symbol_to_interval.end() || position == this->positions.end())
+	{
+		return true;
+	}
+	return this->intervals[found->second].end > position->second;
+}
+
+int LinearScan::next_use(SymbolTable::Index symbol, const void* node) const
+{
+	const auto& found = this->symbol_to_interval.find(symbol);
+	const auto& position = this->positions.find(node);
+	if (found == this->symbol_to_interval.end() || position == this->positions.end())
+	{
+		// nothing is known, so it counts as read right away
+		return 0;
+	}
+	const Interval& interval = this->intervals[found->second];
+	const auto& next = std::upper_bound(interval.uses.begin(), interval.uses.end(), position->second);
+	if (next != interval.uses.end())
+	{
+		return *next;
+	}
+	return interval.end > position->second ? interval.end : -1;
+}
+
+const std::vector<SymbolTable::Index>* LinearScan::ending_at(const void* node) const
+{
+	const auto& found = this->endings.find(node);
+	if (found == this->endings.end())
+	{
+		return nullptr;
+	}
+	return &found->second;
+}
+
+void* LinearScan::visitExprBinary(Expr::Binary& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprGrouping(Expr::Grouping& expr)
+{
+	expr.expression->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprLiteral(Expr::Literal& expr)
+{
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprUnary(Expr::Unary& expr)
+{
+	expr.right->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprVariable(Expr::Variable& expr)
+{
+	this->number(expr.downcast());
+	this->use(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprAssignment(Expr::Assignment& expr)
+{
+	expr.value->accept(*this);
+	this->number(expr.downcast());
+	this->use(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprCall(Expr::Call& expr)
+{
+	// the callee is a function name, never a local
+	for (auto& arg : expr.arguments)
+	{
+		arg->accept(*this);
+	}
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprLogical(Expr::Logical& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprSelect(Expr::Select& expr)
+{
+	expr.condition->accept(*this);
+	expr.if_true->accept(*this);
+	expr.if_false->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	expr.device->accept(*this);
+	this->number(expr.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtExpression(Stmt::Expression& stmt)
+{
+	stmt.expression->accept(*this);
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtAsm(Stmt::Asm& stmt)
+{
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtPrint(Stmt::Print& stmt)
+{
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtVariable(Stmt::Variable& stmt)
+{
+	stmt.initalizer->accept(*this);
+	this->number(stmt.downcast());
+	SymbolTable::Index symbol = this->program.table.lookup_index(stmt.downcast());
+	if (symbol != SymbolTable::Invalid && this->program.table.lookup(symbol).beginning().id() == stmt.downcast())
+	{
+		this->begin_interval(symbol, this->positions.at(stmt.downcast()), stmt.downcast());
+	}
+	return nullptr;
+}
+
+void* LinearScan::visitStmtBlock(Stmt::Block& stmt)
+{
+	for (auto& statement : stmt.statements)
+	{
+		statement->accept(*this);
+	}
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.branch_true->accept(*this);
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+	}
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtFunction(Stmt::Function& stmt)
+{
+	throw std::logic_error("Functions cannot be nested.");
+}
+
+void* LinearScan::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		stmt.value->accept(*this);
+	}
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtWhile(Stmt::While& stmt)
+{
+	this->loops.push_back(Loop{ this->position++, {} });
+	stmt.condition->accept(*this);
+	stmt.body->accept(*this);
+	this->number(stmt.downcast());
+	Loop loop = std::move(this->loops.back());
+	this->loops.pop_back();
+	for (SymbolTable::Index symbol : loop.extended)
+	{
+		this->extend(symbol, this->positions.at(stmt.downcast()), stmt.downcast());
+	}
+	return nullptr;
+}
+
+void* LinearScan::visitStmtStatic(Stmt::Static& stmt)
+{
+	this->number(stmt.downcast());
+	return nullptr;
+}
+
+void* LinearScan::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	stmt.device->accept(*this);
+	stmt.value->accept(*this);
+	this->number(stmt.downcast());
+	return nullptr;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+// Assigns registers to the locals and parameters of a single function.
+// Every AST node is numbered in the order the code generator visits it, each symbol becomes the interval
+// between its definition and its last use, and the intervals are packed into registers with linear scan.
+// A symbol either owns its register for its whole interval or lives on the stack.
+class LinearScan : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	static constexpr int NoRegister = -1;
+
+	LinearScan(TypeCheckedProgram& program, Stmt::Function& function);
+
+	// keeps the parameter in the given register, which must not be in the pool
+	void precolor_parameter(size_t index, int reg);
+	// registers are handed out in the order given
+	void allocate(const std::vector<int>& pool);
+
+	int register_of(SymbolTable::Index symbol) const;
+	int register_of_definition(Stmt::Variable& stmt);
+	int register_of_parameter(size_t index) const;
+	SymbolTable::Index parameter_symbol(size_t index) const;
+	// whether the symbol is still read after this node has been generated
+	bool live_after(SymbolTable::Index symbol, const void* node) const;
+	// position of the first read of the symbol after this node, the end of its interval when that read is on a
+	// later iteration of a loop, or -1 once it is dead
+	int next_use(SymbolTable::Index symbol, const void* node) const;
+	// symbols whose interval ends once this node has been generated
+	const std::vector<SymbolTable::Index>* ending_at(const void* node) const;
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprLiteral(Expr::Literal& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprVariable(Expr::Variable& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
+	virtual void* visitStmtPrint(Stmt::Print& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtFunction(Stmt::Function& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtStatic(Stmt::Static& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+private:
+	struct Interval
+	{
+		SymbolTable::Index symbol;
+		int start;
+		int end;
+		// node after which the symbol is dead, null when it lives until the function returns
+		const void* end_node;
+		int reg;
+		// positions of the reads the walk sees, in order
+		std::vector<int> uses;
+	};
+
+	struct Loop
+	{
+		int start;
+		std::vector<SymbolTable::Index> extended;
+	};
+
+	void number(const void* node);
+	void begin_interval(SymbolTable::Index symbol, int start, const void* node);
+	void use(const void* node);
+	void extend(SymbolTable::Index symbol, int position, const void* node);
+	void finish_intervals();
+
+	TypeCheckedProgram& program;
+	int position;
+	std::unordered_map<const void*, int> positions;
+	std::vector<Loop> loops;
+	std::vector<Interval> intervals;
+	std::unordered_map<SymbolTable::Index, size_t> symbol_to_interval;
+	std::vector<SymbolTable::Index> parameters;
+	std::unordered_map<const void*, std::vector<SymbolTable::Index>> endings;
+};
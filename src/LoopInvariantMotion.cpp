@@ -0,0 +1,377 @@
+#include "LoopInvariantMotion.h"
+#include "Compiler.h"
+#include "ExprUtil.h"
+
+LoopSummary::LoopSummary(Stmt::While& loop)
+	:calls(false)
+{
+	loop.condition->accept(*this);
+	loop.body->accept(*this);
+}
+
+void* LoopSummary::visitExprBinary(Expr::Binary& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprGrouping(Expr::Grouping& expr)
+{
+	expr.expression->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprUnary(Expr::Unary& expr)
+{
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprAssignment(Expr::Assignment& expr)
+{
+	expr.value->accept(*this);
+	this->written.insert(expr.name.lexeme);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprCall(Expr::Call& expr)
+{
+	for (auto& arg : expr.arguments)
+	{
+		arg->accept(*this);
+	}
+	this->calls = true;
+	return nullptr;
+}
+
+void* LoopSummary::visitExprLogical(Expr::Logical& expr)
+{
+	expr.left->accept(*this);
+	expr.right->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprSelect(Expr::Select& expr)
+{
+	expr.condition->accept(*this);
+	expr.if_true->accept(*this);
+	expr.if_false->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitExprDeviceLoad(Expr::DeviceLoad& expr)
+{
+	expr.device->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtExpression(Stmt::Expression& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtAsm(Stmt::Asm& stmt)
+{
+	for (const auto& reference : stmt.referenced_variables())
+	{
+		if (reference.size() > 1 && reference[1] == '&')
+		{
+			this->written.insert(reference.substr(2));
+		}
+	}
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtPrint(Stmt::Print& stmt)
+{
+	stmt.expression->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtVariable(Stmt::Variable& stmt)
+{
+	// a new variable each iteration, and it shadows any outer one with the same name
+	this->written.insert(stmt.name.lexeme);
+	stmt.initalizer->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtBlock(Stmt::Block& stmt)
+{
+	for (auto& statement : stmt.statements)
+	{
+		statement->accept(*this);
+	}
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.branch_true->accept(*this);
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+	}
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtReturn(Stmt::Return& stmt)
+{
+	if (stmt.value)
+	{
+		stmt.value->accept(*this);
+	}
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtWhile(Stmt::While& stmt)
+{
+	stmt.condition->accept(*this);
+	stmt.body->accept(*this);
+	return nullptr;
+}
+
+void* LoopSummary::visitStmtDeviceSet(Stmt::DeviceSet& stmt)
+{
+	stmt.device->accept(*this);
+	stmt.value->accept(*this);
+	return nullptr;
+}
+
+LoopInvariantMotion::LoopInvariantMotion(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program), hoisted(0), loop(nullptr), line(0)
+{}
+
+bool LoopInvariantMotion::run()
+{
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Static>())
+		{
+			Stmt& var = *stmt->as<Stmt::Static>().var;
+			if (var.is<Stmt::Variable>())
+			{
+				this->statics.insert(var.as<Stmt::Variable>().name.lexeme);
+			}
+		}
+	}
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			stmt->accept(*this);
+		}
+	}
+	return this->hoisted > 0;
+}
+
+void LoopInvariantMotion::process(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+	for (size_t i = 0; i < statements.size(); i++)
+	{
+		statements[i]->accept(*this);
+		if (this->preheader.size())
+		{
+			std::vector<std::unique_ptr<Stmt>> preheader = std::move(this->preheader);
+			this->preheader.clear();
+			statements.insert(statements.begin() + i, std::make_move_iterator(preheader.begin()), std::make_move_iterator(preheader.end()));
+			i += preheader.size();
+		}
+	}
+}
+
+void LoopInvariantMotion::process_branch(std::unique_ptr<Stmt>& branch, const Token& token)
+{
+	std::vector<std::unique_ptr<Stmt>> statements;
+	statements.push_back(std::move(branch));
+	this->process(statements);
+	if (statements.size() == 1)
+	{
+		branch = std::move(statements.back());
+		return;
+	}
+	branch = std::make_unique<Stmt::Block>(std::move(statements), token);
+}
+
+void* LoopInvariantMotion::visitStmtFunction(Stmt::Function& stmt)
+{
+	this->process(stmt.body);
+	return nullptr;
+}
+
+void* LoopInvariantMotion::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->process(stmt.statements);
+	return nullptr;
+}
+
+void* LoopInvariantMotion::visitStmtIf(Stmt::If& stmt)
+{
+	this->process_branch(stmt.branch_true, stmt.token);
+	if (stmt.branch_false)
+	{
+		this->process_branch(stmt.branch_false, stmt.token);
+	}
+	return nullptr;
+}
+
+void* LoopInvariantMotion::visitStmtWhile(Stmt::While& stmt)
+{
+	// inner loops first, what they hoist may be invariant in this loop as well
+	this->process_branch(stmt.body, stmt.token);
+	LoopSummary summary(stmt);
+	this->loop = &summary;
+	this->line = stmt.token.line;
+	this->hoist(stmt.condition);
+	this->hoist_from(*stmt.body);
+	this->loop = nullptr;
+	return nullptr;
+}
+
+void LoopInvariantMotion::hoist_from(Stmt& stmt)
+{
+	if (stmt.is<Stmt::Expression>())
+	{
+		this->hoist(stmt.as<Stmt::Expression>().expression);
+	}
+	else if (stmt.is<Stmt::Print>())
+	{
+		this->hoist(stmt.as<Stmt::Print>().expression);
+	}
+	else if (stmt.is<Stmt::Variable>())
+	{
+		this->hoist(stmt.as<Stmt::Variable>().initalizer);
+	}
+	else if (stmt.is<Stmt::Return>())
+	{
+		Stmt::Return& ret = stmt.as<Stmt::Return>();
+		if (ret.value && !ret.tail_call)
+		{
+			this->hoist(ret.value);
+		}
+	}
+	else if (stmt.is<Stmt::DeviceSet>())
+	{
+		this->hoist(stmt.as<Stmt::DeviceSet>().device);
+		this->hoist(stmt.as<Stmt::DeviceSet>().value);
+	}
+	else if (stmt.is<Stmt::Block>())
+	{
+		for (auto& statement : stmt.as<Stmt::Block>().statements)
+		{
+			this->hoist_from(*statement);
+		}
+	}
+	else if (stmt.is<Stmt::If>())
+	{
+		Stmt::If& branch = stmt.as<Stmt::If>();
+		this->hoist(branch.condition);
+		this->hoist_from(*branch.branch_true);
+		if (branch.branch_false)
+		{
+			this->hoist_from(*branch.branch_false);
+		}
+	}
+	else if (stmt.is<Stmt::While>())
+	{
+		this->hoist(stmt.as<Stmt::While>().condition);
+		this->hoist_from(*stmt.as<Stmt::While>().body);
+	}
+}
+
+void LoopInvariantMotion::hoist(std::shared_ptr<Expr>& expr)
+{
+	if (this->preheader.size() < max_hoisted_per_loop && expr_util::is_computed_value(*expr) && this->is_invariant(*expr))
+	{
+		Token name(this->line, TokenType::IDENTIFIER, this->compiler.fresh_name("h"));
+		this->compiler.info(std::string("Hoisted ") + expr->to_string() + " out of the loop on line " + std::to_string(this->line) + " into " + name.lexeme);
+		std::shared_ptr<Expr::Variable> value = std::make_shared<Expr::Variable>(name);
+		value->type = expr->type;
+		this->preheader.push_back(std::make_unique<Stmt::Variable>(TypeName(true, *expr->type.m_type_name), name, expr));
+		this->hoisted++;
+		expr = value;
+		return;
+	}
+	if (expr->is<Expr::Binary>())
+	{
+		this->hoist(expr->as<Expr::Binary>().left);
+		this->hoist(expr->as<Expr::Binary>().right);
+	}
+	else if (expr->is<Expr::Unary>())
+	{
+		this->hoist(expr->as<Expr::Unary>().right);
+	}
+	else if (expr->is<Expr::Grouping>())
+	{
+		this->hoist(expr->as<Expr::Grouping>().expression);
+	}
+	else if (expr->is<Expr::Assignment>())
+	{
+		this->hoist(expr->as<Expr::Assignment>().value);
+	}
+	else if (expr->is<Expr::Call>())
+	{
+		for (auto& arg : expr->as<Expr::Call>().arguments)
+		{
+			this->hoist(arg);
+		}
+	}
+	else if (expr->is<Expr::Logical>())
+	{
+		this->hoist(expr->as<Expr::Logical>().left);
+		this->hoist(expr->as<Expr::Logical>().right);
+	}
+	else if (expr->is<Expr::Select>())
+	{
+		this->hoist(expr->as<Expr::Select>().condition);
+		this->hoist(expr->as<Expr::Select>().if_true);
+		this->hoist(expr->as<Expr::Select>().if_false);
+	}
+	else if (expr->is<Expr::DeviceLoad>())
+	{
+		this->hoist(expr->as<Expr::DeviceLoad>().device);
+	}
+}
+
+bool LoopInvariantMotion::is_invariant(Expr& expr) const
+{
+	if (expr.is<Expr::Literal>())
+	{
+		return true;
+	}
+	if (expr.is<Expr::Variable>())
+	{
+		const std::string& name = expr.as<Expr::Variable>().name.lexeme;
+		return !this->loop->written.count(name) && !(this->loop->calls && this->statics.count(name));
+	}
+	if (expr.is<Expr::Grouping>())
+	{
+		return this->is_invariant(*expr.as<Expr::Grouping>().expression);
+	}
+	if (expr.is<Expr::Unary>())
+	{
+		return this->is_invariant(*expr.as<Expr::Unary>().right);
+	}
+	if (expr.is<Expr::Binary>())
+	{
+		return this->is_invariant(*expr.as<Expr::Binary>().left) && this->is_invariant(*expr.as<Expr::Binary>().right);
+	}
+	if (expr.is<Expr::Logical>())
+	{
+		return this->is_invariant(*expr.as<Expr::Logical>().left) && this->is_invariant(*expr.as<Expr::Logical>().right);
+	}
+	if (expr.is<Expr::Select>())
+	{
+		Expr::Select& select = expr.as<Expr::Select>();
+		return this->is_invariant(*select.condition) && this->is_invariant(*select.if_true) && this->is_invariant(*select.if_false);
+	}
+	if (expr.is<Expr::DeviceLoad>())
+	{
+		// devices can change between any two reads unless the program says otherwise
+		return expr.as<Expr::DeviceLoad>().stable && this->is_invariant(*expr.as<Expr::DeviceLoad>().device);
+	}
+	return false;
+}
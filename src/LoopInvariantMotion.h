@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// What a loop can change while it runs, gathered from its condition and body.
+class LoopSummary : public Expr::Visitor, public Stmt::Visitor
+{
+public:
+	explicit LoopSummary(Stmt::While& loop);
+
+	// assigned, written by asm or declared somewhere in the loop
+	std::unordered_set<std::string> written;
+	// a call can assign any static
+	bool calls;
+
+	virtual void* visitExprBinary(Expr::Binary& expr) override;
+	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
+	virtual void* visitExprUnary(Expr::Unary& expr) override;
+	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
+	virtual void* visitExprCall(Expr::Call& expr) override;
+	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
+	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
+
+	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
+	virtual void* visitStmtAsm(Stmt::Asm& stmt) override;
+	virtual void* visitStmtPrint(Stmt::Print& stmt) override;
+	virtual void* visitStmtVariable(Stmt::Variable& stmt) override;
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtReturn(Stmt::Return& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& stmt) override;
+};
+
+// Moves expressions that give the same value on every iteration of a loop in front of it.
+// Only arithmetic, comparisons and dload stable are moved, each into a new constant local.
+// Works on a checked program, which has to be checked again once anything was hoisted.
+class LoopInvariantMotion : public Stmt::Visitor
+{
+public:
+	LoopInvariantMotion(Compiler& compiler, TypeCheckedProgram& program);
+
+	// returns whether anything was hoisted
+	bool run();
+
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtFunction(Stmt::Function& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+private:
+	// every hoisted value holds a register for the whole loop
+	static constexpr int max_hoisted_per_loop = 4;
+
+	void process(std::vector<std::unique_ptr<Stmt>>& statements);
+	void process_branch(std::unique_ptr<Stmt>& branch, const Token& token);
+	void hoist_from(Stmt& stmt);
+	void hoist(std::shared_ptr<Expr>& expr);
+	bool is_invariant(Expr& expr) const;
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	std::unordered_set<std::string> statics;
+	int hoisted;
+
+	// the loop being hoisted out of, and what was hoisted in front of it so far
+	const LoopSummary* loop;
+	int line;
+	std::vector<std::unique_ptr<Stmt>> preheader;
+};
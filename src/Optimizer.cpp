@@ -1,8 +1,26 @@
+#include <cmath>
+
 #include "Optimizer.h"
 #include "Compiler.h"
+#include "Interpreter.h"
+#include "ExprUtil.h"
 
 #define BOOL_TO_STR(val) ((val) ? "true" : "false")
-#define FOLD_INTO(thing_to_fold_into, accepted) do { void* value = accepted; if (value) { thing_to_fold_into = std::shared_ptr<Expr::Literal>(static_cast<Expr::Literal*>(value)); } }  while (0)
+#define FOLD_INTO(thing_to_fold_into, accepted) do { void* value = accepted; if (value) { thing_to_fold_into = std::shared_ptr<Expr::Literal>(static_cast<Expr::Literal*>(value)); } else { this->simplify(thing_to_fold_into); } }  while (0)
+
+const std::vector<Optimizer::Rule> Optimizer::rules = {
+	{ "multiply by one", &Optimizer::multiply_by_one },
+	{ "multiply by zero", &Optimizer::multiply_by_zero },
+	{ "add zero", &Optimizer::add_zero },
+	{ "subtract itself", &Optimizer::subtract_itself },
+	{ "divide by one", &Optimizer::divide_by_one },
+	{ "divide by power of two", &Optimizer::divide_by_power_of_two },
+	{ "reassociate sum", &Optimizer::reassociate_sum },
+	{ "reassociate product", &Optimizer::reassociate_product },
+	{ "double negation", &Optimizer::double_negation },
+	{ "logical identity", &Optimizer::logical_identity },
+	{ "logical constant", &Optimizer::logical_constant },
+};
 
 Optimizer::Optimizer(Compiler& compiler, TypeCheckedProgram& env)
 	:compiler(compiler), m_env(env), local_env(env.env().root())
@@ -10,7 +28,16 @@ Optimizer::Optimizer(Compiler& compiler, TypeCheckedProgram& env)
 
 void Optimizer::optimize()
 {
+	this->call_graph = std::make_unique<CallGraph>(this->m_env.statements());
 	this->evaluate(this->m_env.statements());
+	for (const auto& rule : rules)
+	{
+		const auto& found = this->applied.find(rule.name);
+		if (found != this->applied.end())
+		{
+			this->compiler.info(std::string("Simplification ") + rule.name + " applied " + std::to_string(found->second) + " times.");
+		}
+	}
 }
 
 void Optimizer::evaluate(std::vector<std::unique_ptr<Stmt>>& statements)
@@ -30,6 +57,15 @@ std::unique_ptr<Stmt> Optimizer::visit_stmt(std::unique_ptr<Stmt>& stmt)
 	return std::unique_ptr<Stmt>(static_cast<Stmt*>(stmt->accept(*this)));
 }
 
+void Optimizer::visit_branch(std::unique_ptr<Stmt>& branch)
+{
+	std::unique_ptr<Stmt> stmt = this->visit_stmt(branch);
+	if (stmt)
+	{
+		branch = std::move(stmt);
+	}
+}
+
 static bool is_arithmentic(TokenType token)
 {
 	switch (token)
@@ -39,8 +75,9 @@ static bool is_arithmentic(TokenType token)
 	case TokenType::STAR:
 	case TokenType::SLASH:
 		return true;
+	default:
+		return false;
 	}
-	return false;
 }
 
 static void* emit_boolean_literal(const Token& parent, bool value)
@@ -110,7 +147,7 @@ void* Optimizer::visitExprBinary(Expr::Binary& expr)
 				throw std::runtime_error("OPTIMIZER ERROR: !ARITHMETIC TOKEN WAS NOT OF ARITHMETIC TYPE!");
 				break;
 			}
-			return new Expr::Literal(Token(expr.op.line, TokenType::NUMBER, std::to_string(result), result));
+			return new Expr::Literal(Token(expr.op.line, TokenType::NUMBER, Literal(result).to_lexeme(), result));
 		}
 		if (literal_left.literal.literal.boolean && literal_right.literal.literal.boolean)
 		{
@@ -220,6 +257,12 @@ void* Optimizer::visitExprUnary(Expr::Unary& expr)
 		switch (expr.op.type)
 		{
 		case TokenType::BANG:
+			if (right.literal.literal.is_number())
+			{
+				// ! takes a number and gives 1 for zero and 0 for anything else
+				result = right.literal.literal.as_number() == 0 ? 1.0 : 0.0;
+				return new Expr::Literal(Token(expr.op.line, result.type(), result.to_lexeme(), result.as_number()));
+			}
 			result = !right.literal.literal.as_boolean();
 			return new Expr::Literal(Token(expr.op.line, result.type(), result.to_lexeme(), result.as_boolean()));
 		case TokenType::MINUS:
@@ -266,7 +309,44 @@ void* Optimizer::visitExprCall(Expr::Call& expr)
 		auto& arg = expr.arguments[i];
 		FOLD_INTO(expr.arguments[i], arg->accept(*this));
 	}
-	return nullptr;
+	return this->evaluate_call(expr);
+}
+
+Expr::Literal* Optimizer::evaluate_call(Expr::Call& expr)
+{
+	Stmt::Function* function = expr.callee->is<Expr::Variable>() ? this->call_graph->function(expr.callee->as<Expr::Variable>().name.lexeme) : nullptr;
+	if (!function || !this->call_graph->is_pure(*function))
+	{
+		return nullptr;
+	}
+	std::vector<Literal> arguments;
+	for (auto& arg : expr.arguments)
+	{
+		if (!arg->is<Expr::Literal>())
+		{
+			return nullptr;
+		}
+		arguments.push_back(arg->as<Expr::Literal>().literal.literal);
+	}
+	Interpreter interpreter(*this->call_graph, evaluation_budget);
+	std::unique_ptr<Literal> result;
+	try
+	{
+		result.reset(interpreter.call(*function, arguments));
+	}
+	catch (const Interpreter::Unevaluable& error)
+	{
+		this->compiler.info(std::string("Could not evaluate call to ") + function->name.lexeme + " on line " +
+			std::to_string(expr.paren.line) + ": " + error.what());
+		return nullptr;
+	}
+	if (!result || (result->is_number() && !std::isfinite(result->as_number())))
+	{
+		return nullptr;
+	}
+	this->compiler.info(std::string("Evaluated call to ") + function->name.lexeme + " on line " +
+		std::to_string(expr.paren.line) + ": " + result->to_lexeme());
+	return new Expr::Literal(Token(expr.paren.line, result->type(), result->to_lexeme(), *result));
 }
 
 void* Optimizer::visitExprLogical(Expr::Logical& expr)
@@ -311,6 +391,23 @@ void* Optimizer::visitExprLogical(Expr::Logical& expr)
 	return nullptr;
 }
 
+void* Optimizer::visitExprSelect(Expr::Select& expr)
+{
+	FOLD_INTO(expr.condition, expr.condition->accept(*this));
+	FOLD_INTO(expr.if_true, expr.if_true->accept(*this));
+	FOLD_INTO(expr.if_false, expr.if_false->accept(*this));
+	if (!expr.condition->is<Expr::Literal>())
+	{
+		return nullptr;
+	}
+	std::shared_ptr<Expr>& chosen = expr.condition->as<Expr::Literal>().literal.literal.as_boolean() ? expr.if_true : expr.if_false;
+	if (!chosen->is<Expr::Literal>())
+	{
+		return nullptr;
+	}
+	return new Expr::Literal(chosen->as<Expr::Literal>());
+}
+
 void* Optimizer::visitStmtExpression(Stmt::Expression& stmt)
 {
 	FOLD_INTO(stmt.expression, stmt.expression->accept(*this));
@@ -374,13 +471,21 @@ void* Optimizer::visitStmtBlock(Stmt::Block& stmt)
 void* Optimizer::visitStmtWhile(Stmt::While& expr)
 {
 	FOLD_INTO(expr.condition, expr.condition->accept(*this));
-	this->visit_stmt(expr.body);
+	this->visit_branch(expr.body);
 	return nullptr;
 }
 
 void* Optimizer::visitStmtIf(Stmt::If& stmt)
 {
 	Expr::Literal* condition_literal = static_cast<Expr::Literal*>(stmt.condition->accept(*this));
+	if (!condition_literal)
+	{
+		this->simplify(stmt.condition);
+		if (stmt.condition->is<Expr::Literal>())
+		{
+			condition_literal = &stmt.condition->as<Expr::Literal>();
+		}
+	}
 	if (condition_literal)
 	{
 		Literal& literal = condition_literal->literal.literal;
@@ -392,6 +497,8 @@ void* Optimizer::visitStmtIf(Stmt::If& stmt)
 					std::to_string(condition_literal->literal.line) +
 					" simplified to true brach."
 				);
+				// the kept branch still reads fixed locals, which only visiting it replaces
+				this->visit_branch(stmt.branch_true);
 				return stmt.branch_true.release();
 			}
 			if (stmt.branch_false)
@@ -400,6 +507,7 @@ void* Optimizer::visitStmtIf(Stmt::If& stmt)
 					std::to_string(condition_literal->literal.line) +
 					" simplified to false branch."
 				);
+				this->visit_branch(stmt.branch_false);
 				return stmt.branch_false.release();
 			}
 			this->compiler.info(std::string("Branching on line ") +
@@ -409,12 +517,68 @@ void* Optimizer::visitStmtIf(Stmt::If& stmt)
 			return new Stmt::Block({}, stmt.token);
 		}
 	}
-	stmt.branch_true->accept(*this);
+	this->visit_branch(stmt.branch_true);
 	if (stmt.branch_false)
 	{
-		stmt.branch_false->accept(*this);
+		this->visit_branch(stmt.branch_false);
 	}
-	return nullptr;
+	return this->convert_to_select(stmt);
+}
+
+// the assignment a branch consists of, if that is all it does
+static Expr::Assignment* single_assignment(Stmt& branch, std::shared_ptr<Expr>** holder)
+{
+	Stmt* stmt = &branch;
+	if (stmt->is<Stmt::Block>())
+	{
+		std::vector<std::unique_ptr<Stmt>>& statements = stmt->as<Stmt::Block>().statements;
+		if (statements.size() != 1)
+		{
+			return nullptr;
+		}
+		stmt = statements[0].get();
+	}
+	if (!stmt->is<Stmt::Expression>() || !stmt->as<Stmt::Expression>().expression->is<Expr::Assignment>())
+	{
+		return nullptr;
+	}
+	*holder = &stmt->as<Stmt::Expression>().expression;
+	return &(**holder)->as<Expr::Assignment>();
+}
+
+static bool is_operand(std::shared_ptr<Expr>& expr)
+{
+	while (expr->is<Expr::Grouping>())
+	{
+		expr = expr->as<Expr::Grouping>().expression;
+	}
+	return expr->is<Expr::Literal>() || expr->is<Expr::Variable>();
+}
+
+Stmt* Optimizer::convert_to_select(Stmt::If& stmt)
+{
+	if (!stmt.branch_false)
+	{
+		return nullptr;
+	}
+	std::shared_ptr<Expr>* true_holder = nullptr;
+	std::shared_ptr<Expr>* false_holder = nullptr;
+	Expr::Assignment* if_true = single_assignment(*stmt.branch_true, &true_holder);
+	Expr::Assignment* if_false = single_assignment(*stmt.branch_false, &false_holder);
+	if (!if_true || !if_false || if_true->name.lexeme != if_false->name.lexeme)
+	{
+		return nullptr;
+	}
+	// select evaluates both sides, which only pays off when neither takes an instruction
+	if (!is_operand(if_true->value) || !is_operand(if_false->value))
+	{
+		return nullptr;
+	}
+	this->compiler.info(std::string("Converted branch on line ") + std::to_string(stmt.token.line) + " into a select of " + if_true->name.lexeme);
+	std::shared_ptr<Expr::Select> select = std::make_shared<Expr::Select>(stmt.token, stmt.condition, if_true->value, if_false->value);
+	select->type = if_true->type;
+	if_true->value = select;
+	return new Stmt::Expression(*true_holder);
 }
 
 void* Optimizer::visitStmtFunction(Stmt::Function& expr)
@@ -424,7 +588,7 @@ void* Optimizer::visitStmtFunction(Stmt::Function& expr)
 	{
 		throw std::runtime_error("Attempted to enter a statement which does not confer an environment.");
 	}
-	// todo: fold/inline functions
+	// todo: fold functions
 	this->evaluate(expr.body);
 	this->local_env = this->local_env->get_parent();
 	return nullptr;
@@ -435,6 +599,482 @@ void* Optimizer::visitStmtReturn(Stmt::Return& expr)
 	if (expr.value)
 	{
 		FOLD_INTO(expr.value, expr.value->accept(*this));
+		while (expr.value->is<Expr::Grouping>())
+		{
+			expr.value = expr.value->as<Expr::Grouping>().expression;
+		}
+		expr.tail_call = false;
+		if (expr.value->is<Expr::Call>())
+		{
+			// nothing runs after the call, so the callee can return straight to our caller
+			expr.tail_call = true;
+			this->compiler.info(std::string("Call on line ") + std::to_string(expr.keyword.line) + " is in tail position");
+		}
 	}
 	return nullptr;
-}
\ No newline at end of file
+}
+
+static bool number_of(std::shared_ptr<Expr>& expr, double& value)
+{
+	std::shared_ptr<Expr>& inner = expr_util::unwrap(expr);
+	if (!inner->is<Expr::Literal>() || !inner->as<Expr::Literal>().literal.literal.is_number())
+	{
+		return false;
+	}
+	value = inner->as<Expr::Literal>().literal.literal.as_number();
+	return true;
+}
+
+static bool is_number(std::shared_ptr<Expr>& expr, double value)
+{
+	double found;
+	return number_of(expr, found) && found == value;
+}
+
+// every integer up to 2^53 is a double, so integer sums within it never round
+static const double max_exact_integer = 9007199254740992.0;
+
+static bool is_power_of_two(double value)
+{
+	int exponent;
+	return std::isnormal(value) && std::fabs(std::frexp(value, &exponent)) == 0.5;
+}
+
+// whether an expression always gives an integer no larger than bound, where sums and products stay exact
+static bool integer_bound(std::shared_ptr<Expr>& expr, double& bound)
+{
+	std::shared_ptr<Expr>& inner = expr_util::unwrap(expr);
+	if (inner->is<Expr::Literal>())
+	{
+		const Literal& literal = inner->as<Expr::Literal>().literal.literal;
+		if (literal.is_boolean())
+		{
+			bound = 1;
+			return true;
+		}
+		if (!literal.is_integral())
+		{
+			return false;
+		}
+		bound = std::fabs(literal.as_number());
+		return true;
+	}
+	if (inner->is<Expr::Unary>())
+	{
+		Expr::Unary& unary = inner->as<Expr::Unary>();
+		if (unary.op.type == TokenType::BANG)
+		{
+			bound = 1;
+			return true;
+		}
+		return unary.op.type == TokenType::MINUS && integer_bound(unary.right, bound);
+	}
+	if (!inner->is<Expr::Binary>())
+	{
+		return false;
+	}
+	Expr::Binary& binary = inner->as<Expr::Binary>();
+	double left, right;
+	switch (binary.op.type)
+	{
+	case TokenType::EQUAL_EQUAL:
+	case TokenType::BANG_EQUAL:
+	case TokenType::GREATER:
+	case TokenType::GREATER_EQUAL:
+	case TokenType::LESS:
+	case TokenType::LESS_EQUAL:
+		bound = 1;
+		return true;
+	case TokenType::PLUS:
+	case TokenType::MINUS:
+		if (!integer_bound(binary.left, left) || !integer_bound(binary.right, right))
+		{
+			return false;
+		}
+		bound = left + right;
+		return bound <= max_exact_integer;
+	case TokenType::STAR:
+		if (!integer_bound(binary.left, left) || !integer_bound(binary.right, right))
+		{
+			return false;
+		}
+		bound = left * right;
+		return bound <= max_exact_integer;
+	default:
+		return false;
+	}
+}
+
+static bool boolean_of(std::shared_ptr<Expr>& expr, bool& value)
+{
+	std::shared_ptr<Expr>& inner = expr_util::unwrap(expr);
+	if (!inner->is<Expr::Literal>() || !inner->as<Expr::Literal>().literal.literal.is_boolean())
+	{
+		return false;
+	}
+	value = inner->as<Expr::Literal>().literal.literal.as_boolean();
+	return true;
+}
+
+static std::shared_ptr<Expr> number_literal(int line, double value)
+{
+	return std::make_shared<Expr::Literal>(Token(line, TokenType::NUMBER, Literal(value).to_lexeme(), value));
+}
+
+// a binary expression on the same line and of the same type as another
+static std::shared_ptr<Expr> binary_like(const Expr::Binary& like, std::shared_ptr<Expr> left, TokenType op, const std::string& lexeme, std::shared_ptr<Expr> right)
+{
+	std::shared_ptr<Expr::Binary> binary = std::make_shared<Expr::Binary>(left, Token(like.op.line, op, lexeme), right);
+	binary->type = like.type;
+	return binary;
+}
+
+// whether both always evaluate to the same value, device reads never do
+static bool same_value(std::shared_ptr<Expr>& left, std::shared_ptr<Expr>& right)
+{
+	Expr& a = *expr_util::unwrap(left);
+	Expr& b = *expr_util::unwrap(right);
+	if (typeid(a) != typeid(b))
+	{
+		return false;
+	}
+	if (a.is<Expr::Variable>())
+	{
+		return a.as<Expr::Variable>().name.lexeme == b.as<Expr::Variable>().name.lexeme;
+	}
+	if (a.is<Expr::Literal>())
+	{
+		return a.as<Expr::Literal>().literal.literal.to_lexeme() == b.as<Expr::Literal>().literal.literal.to_lexeme();
+	}
+	if (a.is<Expr::Unary>())
+	{
+		return a.as<Expr::Unary>().op.type == b.as<Expr::Unary>().op.type && same_value(a.as<Expr::Unary>().right, b.as<Expr::Unary>().right);
+	}
+	if (a.is<Expr::Binary>())
+	{
+		return a.as<Expr::Binary>().op.type == b.as<Expr::Binary>().op.type && same_value(a.as<Expr::Binary>().left, b.as<Expr::Binary>().left) &&
+			same_value(a.as<Expr::Binary>().right, b.as<Expr::Binary>().right);
+	}
+	return false;
+}
+
+void Optimizer::simplify(std::shared_ptr<Expr>& expr)
+{
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (const auto& rule : rules)
+		{
+			if ((this->*rule.simplify)(expr_util::unwrap(expr)))
+			{
+				this->applied[rule.name]++;
+				changed = true;
+			}
+		}
+	}
+}
+
+bool Optimizer::multiply_by_one(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::STAR)
+	{
+		return false;
+	}
+	Expr::Binary& binary = expr->as<Expr::Binary>();
+	if (is_number(binary.right, 1))
+	{
+		expr = binary.left;
+		return true;
+	}
+	if (is_number(binary.left, 1))
+	{
+		expr = binary.right;
+		return true;
+	}
+	return false;
+}
+
+bool Optimizer::multiply_by_zero(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::STAR)
+	{
+		return false;
+	}
+	Expr::Binary& binary = expr->as<Expr::Binary>();
+	if ((is_number(binary.right, 0) && !expr_util::has_effects(*binary.left)) || (is_number(binary.left, 0) && !expr_util::has_effects(*binary.right)))
+	{
+		expr = number_literal(binary.op.line, 0);
+		return true;
+	}
+	return false;
+}
+
+bool Optimizer::add_zero(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>())
+	{
+		return false;
+	}
+	Expr::Binary& binary = expr->as<Expr::Binary>();
+	if ((binary.op.type == TokenType::PLUS || binary.op.type == TokenType::MINUS) && is_number(binary.right, 0))
+	{
+		expr = binary.left;
+		return true;
+	}
+	if (binary.op.type == TokenType::PLUS && is_number(binary.left, 0))
+	{
+		expr = binary.right;
+		return true;
+	}
+	return false;
+}
+
+bool Optimizer::subtract_itself(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::MINUS)
+	{
+		return false;
+	}
+	Expr::Binary& binary = expr->as<Expr::Binary>();
+	if (!same_value(binary.left, binary.right) || expr_util::has_effects(*binary.left))
+	{
+		return false;
+	}
+	expr = number_literal(binary.op.line, 0);
+	return true;
+}
+
+bool Optimizer::divide_by_one(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::SLASH || !is_number(expr->as<Expr::Binary>().right, 1))
+	{
+		return false;
+	}
+	expr = expr->as<Expr::Binary>().left;
+	return true;
+}
+
+bool Optimizer::divide_by_power_of_two(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::SLASH)
+	{
+		return false;
+	}
+	Expr::Binary& binary = expr->as<Expr::Binary>();
+	double divisor;
+	if (!number_of(binary.right, divisor) || divisor == 1 || !is_power_of_two(divisor))
+	{
+		return false;
+	}
+	// the reciprocal of a power of two is exact, and a product can be reassociated
+	double reciprocal = 1 / divisor;
+	if (!std::isnormal(reciprocal))
+	{
+		return false;
+	}
+	expr = binary_like(binary, binary.left, TokenType::STAR, "*", number_literal(binary.op.line, reciprocal));
+	return true;
+}
+
+bool Optimizer::reassociate_sum(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>())
+	{
+		return false;
+	}
+	Expr::Binary& outer = expr->as<Expr::Binary>();
+	if (outer.op.type != TokenType::PLUS && outer.op.type != TokenType::MINUS)
+	{
+		return false;
+	}
+	double outer_constant;
+	std::shared_ptr<Expr>* rest;
+	if (number_of(outer.right, outer_constant))
+	{
+		rest = &outer.left;
+	}
+	else if (outer.op.type == TokenType::PLUS && number_of(outer.left, outer_constant))
+	{
+		rest = &outer.right;
+	}
+	else
+	{
+		return false;
+	}
+	std::shared_ptr<Expr>& inner_expr = expr_util::unwrap(*rest);
+	if (!inner_expr->is<Expr::Binary>())
+	{
+		return false;
+	}
+	Expr::Binary& inner = inner_expr->as<Expr::Binary>();
+	if (inner.op.type != TokenType::PLUS && inner.op.type != TokenType::MINUS)
+	{
+		return false;
+	}
+	// the inner sum as x + constant, or constant - x when x is subtracted
+	double constant;
+	std::shared_ptr<Expr> x;
+	bool subtracted = false;
+	if (number_of(inner.right, constant))
+	{
+		x = inner.left;
+		if (inner.op.type == TokenType::MINUS)
+		{
+			constant = -constant;
+		}
+	}
+	else if (number_of(inner.left, constant))
+	{
+		x = inner.right;
+		subtracted = inner.op.type == TokenType::MINUS;
+	}
+	else
+	{
+		return false;
+	}
+	// a sum of doubles rounds at each step, so (x + 1) + 2 only equals x + 3 when every step is an exact integer
+	double bound;
+	if (!integer_bound(x, bound) || !Literal(constant).is_integral() || !Literal(outer_constant).is_integral())
+	{
+		return false;
+	}
+	if (bound + std::fabs(constant) + std::fabs(outer_constant) > max_exact_integer)
+	{
+		return false;
+	}
+	constant = outer.op.type == TokenType::MINUS ? constant - outer_constant : constant + outer_constant;
+	if (subtracted)
+	{
+		expr = binary_like(outer, number_literal(outer.op.line, constant), TokenType::MINUS, "-", x);
+		return true;
+	}
+	expr = binary_like(outer, x, TokenType::PLUS, "+", number_literal(outer.op.line, constant));
+	return true;
+}
+
+bool Optimizer::reassociate_product(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Binary>() || expr->as<Expr::Binary>().op.type != TokenType::STAR)
+	{
+		return false;
+	}
+	Expr::Binary& outer = expr->as<Expr::Binary>();
+	double outer_constant;
+	std::shared_ptr<Expr>* rest;
+	if (number_of(outer.right, outer_constant))
+	{
+		rest = &outer.left;
+	}
+	else if (number_of(outer.left, outer_constant))
+	{
+		rest = &outer.right;
+	}
+	else
+	{
+		return false;
+	}
+	std::shared_ptr<Expr>& inner_expr = expr_util::unwrap(*rest);
+	if (!inner_expr->is<Expr::Binary>() || inner_expr->as<Expr::Binary>().op.type != TokenType::STAR)
+	{
+		return false;
+	}
+	Expr::Binary& inner = inner_expr->as<Expr::Binary>();
+	double constant;
+	std::shared_ptr<Expr> x;
+	if (number_of(inner.right, constant))
+	{
+		x = inner.left;
+	}
+	else if (number_of(inner.left, constant))
+	{
+		x = inner.right;
+	}
+	else
+	{
+		return false;
+	}
+	// scaling by a power of two only moves the exponent, so rounding once or twice agrees;
+	// both scaling the same way keeps the inner product from overflowing when the whole does not
+	double product = constant * outer_constant;
+	if (!is_power_of_two(constant) && !is_power_of_two(outer_constant))
+	{
+		return false;
+	}
+	if (!std::isnormal(product) || (std::fabs(constant) >= 1) != (std::fabs(outer_constant) >= 1))
+	{
+		return false;
+	}
+	outer.left = x;
+	outer.right = number_literal(outer.op.line, product);
+	return true;
+}
+
+bool Optimizer::double_negation(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Unary>())
+	{
+		return false;
+	}
+	Expr::Unary& outer = expr->as<Expr::Unary>();
+	std::shared_ptr<Expr>& middle = expr_util::unwrap(outer.right);
+	if (!middle->is<Expr::Unary>() || middle->as<Expr::Unary>().op.type != outer.op.type)
+	{
+		return false;
+	}
+	std::shared_ptr<Expr>& inner = expr_util::unwrap(middle->as<Expr::Unary>().right);
+	if (outer.op.type == TokenType::MINUS)
+	{
+		expr = inner;
+		return true;
+	}
+	// !! turns any number into 0 or 1, so it only cancels out on something that already is
+	if (outer.op.type == TokenType::BANG && inner->is<Expr::Unary>() && inner->as<Expr::Unary>().op.type == TokenType::BANG)
+	{
+		expr = inner;
+		return true;
+	}
+	return false;
+}
+
+bool Optimizer::logical_identity(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Logical>())
+	{
+		return false;
+	}
+	Expr::Logical& logical = expr->as<Expr::Logical>();
+	// true for and, false for or
+	bool identity = logical.op.type == TokenType::AND;
+	bool value;
+	if (boolean_of(logical.right, value) && value == identity)
+	{
+		expr = logical.left;
+		return true;
+	}
+	if (boolean_of(logical.left, value) && value == identity)
+	{
+		expr = logical.right;
+		return true;
+	}
+	return false;
+}
+
+bool Optimizer::logical_constant(std::shared_ptr<Expr>& expr)
+{
+	if (!expr->is<Expr::Logical>())
+	{
+		return false;
+	}
+	Expr::Logical& logical = expr->as<Expr::Logical>();
+	// false for and, true for or
+	bool absorbing = logical.op.type == TokenType::OR;
+	bool value;
+	// the right side is skipped anyway, the left side only when leaving it out changes nothing
+	if ((boolean_of(logical.left, value) && value == absorbing) || (boolean_of(logical.right, value) && value == absorbing && !expr_util::has_effects(*logical.left)))
+	{
+		expr = std::shared_ptr<Expr>(static_cast<Expr::Literal*>(emit_boolean_literal(logical.op, absorbing)));
+		return true;
+	}
+	return false;
+}
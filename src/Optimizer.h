@@ -1,6 +1,11 @@
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "AST.h"
+#include "CallGraph.h"
 #include "TypeChecker.h"
 
 class Compiler;
@@ -15,6 +20,8 @@ public:
 	void evaluate(std::vector<std::unique_ptr<Stmt>>& statements);
 
 	std::unique_ptr<Stmt> visit_stmt(std::unique_ptr<Stmt>& stmt);
+	// visits a statement that is the body of another, replacing it when it was rewritten
+	void visit_branch(std::unique_ptr<Stmt>& branch);
 
 	virtual void* visitExprBinary(Expr::Binary& expr) override;
 	virtual void* visitExprGrouping(Expr::Grouping& expr) override;
@@ -24,6 +31,7 @@ public:
 	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
 	virtual void* visitExprCall(Expr::Call& expr) override;
 	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
 	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
 
 	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
@@ -39,7 +47,41 @@ public:
 	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& expr) override;
 
 private:
+	// steps a single call may take when it is evaluated at compile time
+	static constexpr int evaluation_budget = 100000;
+
+	// rewrites the expression into a cheaper one with the same value, returns false when it does not apply
+	typedef bool (Optimizer::*Simplification)(std::shared_ptr<Expr>& expr);
+
+	struct Rule
+	{
+		const char* name;
+		Simplification simplify;
+	};
+
+	static const std::vector<Rule> rules;
+
+	bool multiply_by_one(std::shared_ptr<Expr>& expr);
+	bool multiply_by_zero(std::shared_ptr<Expr>& expr);
+	bool add_zero(std::shared_ptr<Expr>& expr);
+	bool subtract_itself(std::shared_ptr<Expr>& expr);
+	bool divide_by_one(std::shared_ptr<Expr>& expr);
+	bool divide_by_power_of_two(std::shared_ptr<Expr>& expr);
+	bool reassociate_sum(std::shared_ptr<Expr>& expr);
+	bool reassociate_product(std::shared_ptr<Expr>& expr);
+	bool double_negation(std::shared_ptr<Expr>& expr);
+	bool logical_identity(std::shared_ptr<Expr>& expr);
+	bool logical_constant(std::shared_ptr<Expr>& expr);
+
+	Expr::Literal* evaluate_call(Expr::Call& expr);
+	Stmt* convert_to_select(Stmt::If& stmt);
+	// rewrites the expression, looking through parentheses, until no simplification applies
+	void simplify(std::shared_ptr<Expr>& expr);
+
 	Compiler& compiler;
+	std::unique_ptr<CallGraph> call_graph;
 	TypedEnvironment::Leaf* local_env;
 	TypeCheckedProgram& m_env;
+	// times each simplification was applied, by name
+	std::unordered_map<std::string, int> applied;
 };
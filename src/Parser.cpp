@@ -23,6 +23,8 @@ void Parser::synchronize()
 		case TokenType::ASM:
 		case TokenType::RETURN:
 			return;
+		default:
+			break;
 		}
 
 		this->advance();
@@ -607,6 +609,7 @@ std::shared_ptr<Expr> Parser::parse_primary()
 
 std::shared_ptr<Expr> Parser::helper_parse_device_load()
 {
+	bool stable = this->match({ TokenType::STABLE });
 	std::shared_ptr<Expr> device = this->parse_expression();
 	Token logic_type = this->consume(TokenType::STRING, "Expected string for device load logic type.");
 	TypeName operation_type = TypeName("number");
@@ -614,7 +617,9 @@ std::shared_ptr<Expr> Parser::helper_parse_device_load()
 	{
 		operation_type = this->parse_type();
 	}
-	return std::make_shared<Expr::DeviceLoad>(device, logic_type, operation_type);
+	std::shared_ptr<Expr::DeviceLoad> load = std::make_shared<Expr::DeviceLoad>(device, logic_type, operation_type);
+	load->stable = stable;
+	return load;
 }
 
 void Parser::error(const Token& error_token, const std::string& message)
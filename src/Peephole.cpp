@@ -0,0 +1,596 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "Peephole.h"
+#include "Compiler.h"
+
+const std::vector<Peephole::Rule> Peephole::rules = {
+	{ "self move", 1, &Peephole::remove_self_move },
+	{ "dead write", 1, &Peephole::remove_dead_write },
+	{ "stack adjustments", 2, &Peephole::merge_stack_adjustments },
+	{ "split stack adjustments", 3, &Peephole::merge_split_stack_adjustments },
+	{ "push then pop", 2, &Peephole::push_then_pop },
+	{ "pop then push", 2, &Peephole::pop_then_push },
+	{ "push then peek", 2, &Peephole::push_then_peek },
+	{ "write into move", 2, &Peephole::write_into_move },
+	{ "forwarded move", 2, &Peephole::forward_move },
+};
+
+Peephole::Peephole(Compiler& compiler, InstructionBuffer& buffer, int return_register, const std::vector<int>& global_registers)
+	:compiler(compiler), code(buffer.instructions()), return_register(return_register), global_registers(global_registers.begin(), global_registers.end())
+{}
+
+static int count_lines(const std::vector<Instruction>& code)
+{
+	int lines = 0;
+	for (const auto& instruction : code)
+	{
+		if (instruction.occupies_line())
+		{
+			lines++;
+		}
+	}
+	return lines;
+}
+
+int Peephole::run()
+{
+	int before = count_lines(this->code);
+	this->removed.assign(this->code.size(), false);
+	this->find_labels();
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (const auto& rule : rules)
+		{
+			while (this->apply(rule))
+			{
+				changed = true;
+			}
+		}
+		while (this->remove_jumps_to_next())
+		{
+			changed = true;
+		}
+	}
+	for (const auto& rule : rules)
+	{
+		const auto& found = this->applied.find(rule.name);
+		if (found != this->applied.end())
+		{
+			this->compiler.info(std::string("Peephole rule ") + rule.name + " applied " + std::to_string(found->second) + " times.");
+		}
+	}
+	return before - count_lines(this->code);
+}
+
+bool Peephole::apply(const Rule& rule)
+{
+	bool changed = false;
+	std::vector<size_t> window;
+	std::vector<Instruction> replacement;
+	for (size_t i = 0; i < this->code.size(); i++)
+	{
+		window.clear();
+		replacement.clear();
+		if (!this->window_at(i, rule.size, window) || !(this->*rule.rewrite)(window, replacement))
+		{
+			continue;
+		}
+		this->replace(window, replacement);
+		this->applied[rule.name]++;
+		changed = true;
+	}
+	if (changed)
+	{
+		this->compact();
+	}
+	return changed;
+}
+
+bool Peephole::remove_jumps_to_next()
+{
+	bool changed = false;
+	for (size_t i = 0; i < this->code.size(); i++)
+	{
+		const Instruction& instruction = this->code[i];
+		if (this->removed[i] || (instruction.opcode != Opcode::Jump && instruction.opcode != Opcode::JumpRelative && !instruction.is_branch()))
+		{
+			continue;
+		}
+		const Operand& target = instruction.operands.back();
+		if (target.kind != Operand::Kind::Label)
+		{
+			continue;
+		}
+		for (size_t next = i + 1; next < this->code.size(); next++)
+		{
+			const Instruction& following = this->code[next];
+			if (this->removed[next] || following.opcode == Opcode::Comment)
+			{
+				continue;
+			}
+			if (following.opcode != Opcode::Label)
+			{
+				break;
+			}
+			if (following.operands[0].index == target.index)
+			{
+				this->removed[i] = true;
+				this->applied["jump to next line"]++;
+				changed = true;
+				break;
+			}
+		}
+	}
+	if (changed)
+	{
+		this->compact();
+	}
+	return changed;
+}
+
+bool Peephole::window_at(size_t start, size_t size, std::vector<size_t>& window) const
+{
+	for (size_t i = start; i < this->code.size() && window.size() < size; i++)
+	{
+		Opcode opcode = this->code[i].opcode;
+		if (opcode == Opcode::Label)
+		{
+			return false;
+		}
+		if (opcode == Opcode::Comment || this->removed[i])
+		{
+			if (i == start)
+			{
+				return false;
+			}
+			continue;
+		}
+		window.push_back(i);
+	}
+	return window.size() == size;
+}
+
+void Peephole::replace(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	// no rewrite is longer than its window, so it is written over it and nothing moves until compact
+	if (replacement.size() > window.size())
+	{
+		throw std::logic_error("Peephole replacement is longer than the instructions it replaces.");
+	}
+	for (size_t i = 0; i < window.size(); i++)
+	{
+		if (i < replacement.size())
+		{
+			this->code[window[i]] = std::move(replacement[i]);
+			continue;
+		}
+		this->removed[window[i]] = true;
+	}
+}
+
+void Peephole::compact()
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < this->code.size(); i++)
+	{
+		if (this->removed[i])
+		{
+			continue;
+		}
+		if (kept != i)
+		{
+			this->code[kept] = std::move(this->code[i]);
+		}
+		kept++;
+	}
+	this->code.erase(this->code.begin() + kept, this->code.end());
+	this->removed.assign(this->code.size(), false);
+	this->find_labels();
+}
+
+void Peephole::find_labels()
+{
+	this->labels.clear();
+	for (size_t i = 0; i < this->code.size(); i++)
+	{
+		if (this->code[i].opcode == Opcode::Label)
+		{
+			this->labels[this->code[i].operands[0].index] = i;
+		}
+	}
+}
+
+bool Peephole::remove_self_move(const std::vector<size_t>& window, std::vector<Instruction>&)
+{
+	const Instruction& move = this->code[window[0]];
+	return move.opcode == Opcode::Move && move.operands[0] == move.operands[1];
+}
+
+bool Peephole::remove_dead_write(const std::vector<size_t>& window, std::vector<Instruction>&)
+{
+	const Instruction& instruction = this->code[window[0]];
+	if (!is_pure_write(instruction))
+	{
+		return false;
+	}
+	int reg = written_register(instruction);
+	return reg >= 0 && reg < registers::sp && !this->is_live_after(reg, window[0]);
+}
+
+bool Peephole::merge_stack_adjustments(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& first = this->code[window[0]];
+	const Instruction& second = this->code[window[1]];
+	if (!is_stack_adjustment(first) || !is_stack_adjustment(second))
+	{
+		return false;
+	}
+	auto delta = [](const Instruction& instruction)
+	{
+		return instruction.opcode == Opcode::Add ? instruction.operands[2].value : -instruction.operands[2].value;
+	};
+	double total = delta(first) + delta(second);
+	if (total != 0)
+	{
+		Operand sp = Operand::reg(registers::sp);
+		replacement.emplace_back(total > 0 ? Opcode::Add : Opcode::Sub, std::vector<Operand>{ sp, sp, Operand::number(total > 0 ? total : -total) }, first.source_line);
+	}
+	return true;
+}
+
+bool Peephole::merge_split_stack_adjustments(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& between = this->code[window[1]];
+	switch (between.opcode)
+	{
+	case Opcode::Raw:
+	case Opcode::Jump:
+	case Opcode::JumpRelative:
+	case Opcode::JumpAndLink:
+		return false;
+	default:
+		break;
+	}
+	if (between.is_branch() || reads_register(between, registers::sp) || written_register(between) == registers::sp)
+	{
+		return false;
+	}
+	// the instruction in between does not care where sp is, so both adjustments can follow it
+	std::vector<size_t> adjustments = { window[0], window[2] };
+	if (!this->merge_stack_adjustments(adjustments, replacement))
+	{
+		return false;
+	}
+	replacement.insert(replacement.begin(), between);
+	return true;
+}
+
+bool Peephole::push_then_pop(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& push = this->code[window[0]];
+	const Instruction& pop = this->code[window[1]];
+	if (push.opcode != Opcode::Push || pop.opcode != Opcode::Pop)
+	{
+		return false;
+	}
+	// the slot is above sp again, so only the value is left
+	if (push.operands[0] != pop.operands[0])
+	{
+		replacement.emplace_back(Opcode::Move, std::vector<Operand>{ pop.operands[0], push.operands[0] }, pop.source_line);
+	}
+	return true;
+}
+
+bool Peephole::pop_then_push(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& pop = this->code[window[0]];
+	const Instruction& push = this->code[window[1]];
+	if (pop.opcode != Opcode::Pop || push.opcode != Opcode::Push || pop.operands[0] != push.operands[0])
+	{
+		return false;
+	}
+	replacement.emplace_back(Opcode::Peek, pop.operands, pop.source_line);
+	return true;
+}
+
+bool Peephole::push_then_peek(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& push = this->code[window[0]];
+	const Instruction& peek = this->code[window[1]];
+	if (push.opcode != Opcode::Push || peek.opcode != Opcode::Peek)
+	{
+		return false;
+	}
+	replacement.push_back(push);
+	if (push.operands[0] != peek.operands[0])
+	{
+		replacement.emplace_back(Opcode::Move, std::vector<Operand>{ peek.operands[0], push.operands[0] }, peek.source_line);
+	}
+	return true;
+}
+
+bool Peephole::write_into_move(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& write = this->code[window[0]];
+	const Instruction& move = this->code[window[1]];
+	if (!is_pure_write(write) || move.opcode != Opcode::Move || !move.operands[0].is_register())
+	{
+		return false;
+	}
+	int temporary = written_register(write);
+	if (temporary < 0 || temporary >= registers::sp || !move.operands[1].is_register(temporary) || move.operands[0].is_register(temporary))
+	{
+		return false;
+	}
+	if (this->is_live_after(temporary, window[1]))
+	{
+		return false;
+	}
+	replacement.push_back(write);
+	replacement.back().operands[0] = move.operands[0];
+	return true;
+}
+
+bool Peephole::forward_move(const std::vector<size_t>& window, std::vector<Instruction>& replacement)
+{
+	const Instruction& move = this->code[window[0]];
+	const Instruction& user = this->code[window[1]];
+	if (move.opcode != Opcode::Move || user.opcode == Opcode::Raw)
+	{
+		return false;
+	}
+	int temporary = written_register(move);
+	const Operand& source = move.operands[1];
+	if (temporary < 0 || temporary >= registers::sp || (!source.is_register() && source.kind != Operand::Kind::Number))
+	{
+		return false;
+	}
+	// operands that take a value, which can be a register or a number
+	size_t first = 0;
+	size_t last = user.operands.size();
+	switch (user.opcode)
+	{
+	case Opcode::Push:
+		break;
+	case Opcode::Store:
+		first = 2;
+		break;
+	default:
+		if (user.is_branch())
+		{
+			last = user.operands.size() - 1;
+			break;
+		}
+		if (!is_pure_write(user) || user.opcode == Opcode::Load || user.opcode == Opcode::Peek)
+		{
+			return false;
+		}
+		first = 1;
+		break;
+	}
+	Instruction forwarded = user;
+	bool substituted = false;
+	for (size_t i = 0; i < forwarded.operands.size(); i++)
+	{
+		Operand& operand = forwarded.operands[i];
+		bool reads = operand.is_register(temporary) && !(i == 0 && written_register(user) == temporary);
+		if (operand.kind == Operand::Kind::DeviceRegister && operand.index == static_cast<size_t>(temporary))
+		{
+			return false;
+		}
+		if (!reads)
+		{
+			continue;
+		}
+		if (i < first || i >= last)
+		{
+			return false;
+		}
+		operand = source;
+		substituted = true;
+	}
+	if (!substituted)
+	{
+		return false;
+	}
+	if (written_register(user) != temporary && this->is_live_after(temporary, window[1]))
+	{
+		return false;
+	}
+	replacement.push_back(std::move(forwarded));
+	return true;
+}
+
+bool Peephole::is_live_after(int reg, size_t index)
+{
+	std::unordered_set<size_t> visited;
+	int budget = liveness_budget;
+	const Instruction& instruction = this->code[index];
+	if (instruction.is_branch())
+	{
+		const auto& found = this->labels.find(instruction.operands.back().index);
+		if (found == this->labels.end() || this->is_live(reg, found->second, visited, budget))
+		{
+			return true;
+		}
+	}
+	return this->is_live(reg, index + 1, visited, budget);
+}
+
+bool Peephole::is_live(int reg, size_t position, std::unordered_set<size_t>& visited, int& budget)
+{
+	for (size_t i = position; i < this->code.size(); i++)
+	{
+		if (this->removed[i])
+		{
+			continue;
+		}
+		if (!visited.insert(i).second)
+		{
+			// another path already looked from here
+			return false;
+		}
+		if (--budget < 0)
+		{
+			return true;
+		}
+		const Instruction& instruction = this->code[i];
+		switch (instruction.opcode)
+		{
+		case Opcode::Label:
+		case Opcode::Comment:
+			continue;
+		case Opcode::Raw:
+			if (raw_reads_register(instruction.text, reg))
+			{
+				return true;
+			}
+			continue;
+		default:
+			break;
+		}
+		if (reads_register(instruction, reg))
+		{
+			return true;
+		}
+		switch (instruction.opcode)
+		{
+		case Opcode::Jump:
+		case Opcode::JumpRelative:
+		{
+			const Operand& target = instruction.operands[0];
+			if (target.is_register(registers::ra))
+			{
+				// callers save what they need, so only a returned value and statics outlive the function
+				return reg == this->return_register || reg >= registers::sp || this->global_registers.count(reg);
+			}
+			const auto& found = this->labels.find(target.index);
+			if (target.kind != Operand::Kind::Label || found == this->labels.end())
+			{
+				return true;
+			}
+			return this->is_live(reg, found->second, visited, budget);
+		}
+		case Opcode::JumpAndLink:
+			// the callee and whatever runs after it could read anything
+			return true;
+		default:
+			break;
+		}
+		if (instruction.is_branch())
+		{
+			const auto& found = this->labels.find(instruction.operands.back().index);
+			if (found == this->labels.end() || this->is_live(reg, found->second, visited, budget))
+			{
+				return true;
+			}
+		}
+		if (written_register(instruction) == reg)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Peephole::is_pure_write(const Instruction& instruction)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::Move:
+	case Opcode::Add:
+	case Opcode::Sub:
+	case Opcode::Mul:
+	case Opcode::Div:
+	case Opcode::Min:
+	case Opcode::Max:
+	case Opcode::Slt:
+	case Opcode::Sgt:
+	case Opcode::Sle:
+	case Opcode::Sge:
+	case Opcode::Seq:
+	case Opcode::Sne:
+	case Opcode::Seqz:
+	case Opcode::Select:
+	case Opcode::Peek:
+	case Opcode::Load:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int Peephole::written_register(const Instruction& instruction)
+{
+	if (instruction.opcode == Opcode::JumpAndLink)
+	{
+		return registers::ra;
+	}
+	if (!is_pure_write(instruction) && instruction.opcode != Opcode::Pop)
+	{
+		return -1;
+	}
+	const Operand& target = instruction.operands[0];
+	return target.is_register() ? static_cast<int>(target.index) : -1;
+}
+
+bool Peephole::reads_register(const Instruction& instruction, int reg)
+{
+	switch (instruction.opcode)
+	{
+	case Opcode::Push:
+	case Opcode::Pop:
+	case Opcode::Peek:
+		if (reg == registers::sp)
+		{
+			return true;
+		}
+		break;
+	default:
+		break;
+	}
+	size_t first = written_register(instruction) == -1 || instruction.opcode == Opcode::JumpAndLink ? 0 : 1;
+	for (size_t i = first; i < instruction.operands.size(); i++)
+	{
+		const Operand& operand = instruction.operands[i];
+		if ((operand.kind == Operand::Kind::Register || operand.kind == Operand::Kind::DeviceRegister) && reg >= 0 && operand.index == static_cast<size_t>(reg))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Peephole::raw_reads_register(const std::string& text, int reg)
+{
+	std::istringstream words(text.substr(0, text.find('#')));
+	std::string word;
+	std::string name = Operand::reg(reg).to_string();
+	bool first = true;
+	while (words >> word)
+	{
+		// jumps, aliases and indirect registers could read anything
+		if (first && (word[0] == 'j' || word[0] == 'b' || word == "alias" || word == "define"))
+		{
+			return true;
+		}
+		if (word == name || word.compare(0, 2, "rr") == 0 || word == "d" + name)
+		{
+			return true;
+		}
+		first = false;
+	}
+	return false;
+}
+
+bool Peephole::is_stack_adjustment(const Instruction& instruction)
+{
+	if (instruction.opcode != Opcode::Add && instruction.opcode != Opcode::Sub)
+	{
+		return false;
+	}
+	return instruction.operands[0].is_register(registers::sp) && instruction.operands[1].is_register(registers::sp) && instruction.operands[2].kind == Operand::Kind::Number;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Instruction.h"
+
+class Compiler;
+
+// Rewrites short runs of emitted instructions into shorter ones until nothing changes.
+// Runs before labels are resolved, so jumps keep pointing at the code their labels mark.
+// Windows never span a label and skip over comments, raw asm is never rewritten.
+class Peephole
+{
+public:
+	// return_register holds returned values, or is -1 when they are passed on the stack
+	// global_registers hold statics, which outlive every function
+	Peephole(Compiler& compiler, InstructionBuffer& buffer, int return_register, const std::vector<int>& global_registers);
+
+	// returns the number of lines removed
+	int run();
+private:
+	// looks at `size` instructions, returns false or fills in what they are replaced with
+	typedef bool (Peephole::*Rewrite)(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+
+	struct Rule
+	{
+		const char* name;
+		size_t size;
+		Rewrite rewrite;
+	};
+
+	static const std::vector<Rule> rules;
+	// instructions looked at when deciding whether a register is read again
+	static constexpr int liveness_budget = 64;
+
+	bool apply(const Rule& rule);
+	bool remove_jumps_to_next();
+	bool window_at(size_t start, size_t size, std::vector<size_t>& window) const;
+	void replace(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	// drops what replace removed in one pass, which moves the labels
+	void compact();
+	void find_labels();
+
+	bool remove_self_move(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool merge_stack_adjustments(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool merge_split_stack_adjustments(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool push_then_pop(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool pop_then_push(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool push_then_peek(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool remove_dead_write(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool write_into_move(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+	bool forward_move(const std::vector<size_t>& window, std::vector<Instruction>& replacement);
+
+	// whether some path leaving the instruction at `index` reads the register before writing it
+	bool is_live_after(int reg, size_t index);
+	bool is_live(int reg, size_t position, std::unordered_set<size_t>& visited, int& budget);
+
+	static bool is_pure_write(const Instruction& instruction);
+	static int written_register(const Instruction& instruction);
+	static bool reads_register(const Instruction& instruction, int reg);
+	// raw asm is only read for register names, anything that jumps counts as reading everything
+	static bool raw_reads_register(const std::string& text, int reg);
+	static bool is_stack_adjustment(const Instruction& instruction);
+
+	Compiler& compiler;
+	std::vector<Instruction>& code;
+	int return_register;
+	std::unordered_set<int> global_registers;
+	// instructions removed during the current sweep, which everything reading the code skips
+	std::vector<bool> removed;
+	// position of every placed label
+	std::unordered_map<LabelId, size_t> labels;
+	// times each rule was applied, by name
+	std::unordered_map<std::string, int> applied;
+};
@@ -0,0 +1,554 @@
+#include "Propagation.h"
+#include "Compiler.h"
+#include "ExprUtil.h"
+
+Propagation::Propagation(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program), replaced(0), removed(0), function(nullptr)
+{}
+
+bool Propagation::run()
+{
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			this->process(stmt->as<Stmt::Function>());
+		}
+	}
+	if (this->replaced)
+	{
+		this->compiler.info(std::string("Replaced ") + std::to_string(this->replaced) + " reads of variables with known values.");
+	}
+	return this->replaced || this->removed;
+}
+
+void Propagation::process(Stmt::Function& function)
+{
+	this->function = &function;
+	this->collect(function);
+	Facts facts;
+	this->propagate(function.body, facts);
+	this->collect(function);
+	this->propagate_declarations();
+	do
+	{
+		this->collect(function);
+	} while (this->remove_dead_stores());
+	this->function = nullptr;
+}
+
+void Propagation::collect(Stmt::Function& function)
+{
+	this->locals.clear();
+	this->order.clear();
+	this->declarations.clear();
+	this->in_asm.clear();
+	for (const auto& param : function.params)
+	{
+		this->declarations[param.name.lexeme]++;
+	}
+	for (auto& stmt : function.body)
+	{
+		this->collect(stmt);
+	}
+	for (auto& local : this->locals)
+	{
+		if (this->in_asm.count(local.second.name))
+		{
+			local.second.pinned = true;
+		}
+	}
+}
+
+Propagation::Local* Propagation::local(SymbolTable::Index index, const std::string& name)
+{
+	if (index == SymbolTable::Invalid)
+	{
+		return nullptr;
+	}
+	const auto& found = this->locals.find(index);
+	if (found != this->locals.end())
+	{
+		return &found->second;
+	}
+	// locals are declared before they are read, so anything else is a parameter or a static
+	SymbolUseNode beginning = this->program.table.lookup(index).beginning();
+	if (!beginning.is_statement() || &beginning.stmt() != this->function)
+	{
+		return nullptr;
+	}
+	Local& param = this->locals[index];
+	param.name = name;
+	this->order.push_back(index);
+	return &param;
+}
+
+void Propagation::collect(std::unique_ptr<Stmt>& stmt)
+{
+	if (stmt->is<Stmt::Variable>())
+	{
+		Stmt::Variable& var = stmt->as<Stmt::Variable>();
+		SymbolTable::Index index = this->program.table.lookup_index(stmt);
+		if (index != SymbolTable::Invalid)
+		{
+			Local& local = this->locals[index];
+			local.name = var.name.lexeme;
+			local.declaration = &var;
+			local.holder = &stmt;
+			this->order.push_back(index);
+		}
+		this->declarations[var.name.lexeme]++;
+		this->collect(var.initalizer);
+	}
+	else if (stmt->is<Stmt::Expression>())
+	{
+		this->collect(stmt->as<Stmt::Expression>().expression);
+	}
+	else if (stmt->is<Stmt::Print>())
+	{
+		this->collect(stmt->as<Stmt::Print>().expression);
+	}
+	else if (stmt->is<Stmt::Return>())
+	{
+		if (stmt->as<Stmt::Return>().value)
+		{
+			this->collect(stmt->as<Stmt::Return>().value);
+		}
+	}
+	else if (stmt->is<Stmt::DeviceSet>())
+	{
+		this->collect(stmt->as<Stmt::DeviceSet>().device);
+		this->collect(stmt->as<Stmt::DeviceSet>().value);
+	}
+	else if (stmt->is<Stmt::If>())
+	{
+		Stmt::If& branch = stmt->as<Stmt::If>();
+		this->collect(branch.condition);
+		this->collect(branch.branch_true);
+		if (branch.branch_false)
+		{
+			this->collect(branch.branch_false);
+		}
+	}
+	else if (stmt->is<Stmt::While>())
+	{
+		this->collect(stmt->as<Stmt::While>().condition);
+		this->collect(stmt->as<Stmt::While>().body);
+	}
+	else if (stmt->is<Stmt::Block>())
+	{
+		for (auto& statement : stmt->as<Stmt::Block>().statements)
+		{
+			this->collect(statement);
+		}
+	}
+	else if (stmt->is<Stmt::Asm>())
+	{
+		for (const auto& reference : stmt->as<Stmt::Asm>().referenced_variables())
+		{
+			this->in_asm.insert(reference.substr(reference.size() > 1 && reference[1] == '&' ? 2 : 1));
+		}
+	}
+}
+
+void Propagation::collect(std::shared_ptr<Expr>& expr)
+{
+	if (expr->is<Expr::Variable>())
+	{
+		if (Local* local = this->local(this->program.table.lookup_index(expr), expr->as<Expr::Variable>().name.lexeme))
+		{
+			local->reads.push_back(&expr);
+		}
+	}
+	else if (expr->is<Expr::Assignment>())
+	{
+		this->collect(expr->as<Expr::Assignment>().value);
+		if (Local* local = this->local(this->program.table.lookup_index(expr), expr->as<Expr::Assignment>().name.lexeme))
+		{
+			local->writes.push_back(&expr);
+		}
+	}
+	else if (expr->is<Expr::Unary>())
+	{
+		Expr::Unary& unary = expr->as<Expr::Unary>();
+		if (unary.op.type == TokenType::AMPERSAND && unary.right->is<Expr::Variable>())
+		{
+			if (Local* local = this->local(this->program.table.lookup_index(unary.right), unary.right->as<Expr::Variable>().name.lexeme))
+			{
+				local->pinned = true;
+			}
+		}
+		this->collect(unary.right);
+	}
+	else if (expr->is<Expr::Binary>())
+	{
+		this->collect(expr->as<Expr::Binary>().left);
+		this->collect(expr->as<Expr::Binary>().right);
+	}
+	else if (expr->is<Expr::Logical>())
+	{
+		this->collect(expr->as<Expr::Logical>().left);
+		this->collect(expr->as<Expr::Logical>().right);
+	}
+	else if (expr->is<Expr::Select>())
+	{
+		this->collect(expr->as<Expr::Select>().condition);
+		this->collect(expr->as<Expr::Select>().if_true);
+		this->collect(expr->as<Expr::Select>().if_false);
+	}
+	else if (expr->is<Expr::Grouping>())
+	{
+		this->collect(expr->as<Expr::Grouping>().expression);
+	}
+	else if (expr->is<Expr::Call>())
+	{
+		for (auto& arg : expr->as<Expr::Call>().arguments)
+		{
+			this->collect(arg);
+		}
+	}
+	else if (expr->is<Expr::DeviceLoad>())
+	{
+		this->collect(expr->as<Expr::DeviceLoad>().device);
+	}
+}
+
+// the variables assigned anywhere below the top of the expression
+static void nested_assignments(Expr& expr, bool top, std::vector<Expr*>& assignments)
+{
+	if (expr.is<Expr::Assignment>())
+	{
+		if (!top)
+		{
+			assignments.push_back(&expr);
+		}
+		nested_assignments(*expr.as<Expr::Assignment>().value, false, assignments);
+	}
+	else if (expr.is<Expr::Unary>())
+	{
+		nested_assignments(*expr.as<Expr::Unary>().right, false, assignments);
+	}
+	else if (expr.is<Expr::Binary>())
+	{
+		nested_assignments(*expr.as<Expr::Binary>().left, false, assignments);
+		nested_assignments(*expr.as<Expr::Binary>().right, false, assignments);
+	}
+	else if (expr.is<Expr::Logical>())
+	{
+		nested_assignments(*expr.as<Expr::Logical>().left, false, assignments);
+		nested_assignments(*expr.as<Expr::Logical>().right, false, assignments);
+	}
+	else if (expr.is<Expr::Select>())
+	{
+		nested_assignments(*expr.as<Expr::Select>().condition, false, assignments);
+		nested_assignments(*expr.as<Expr::Select>().if_true, false, assignments);
+		nested_assignments(*expr.as<Expr::Select>().if_false, false, assignments);
+	}
+	else if (expr.is<Expr::Grouping>())
+	{
+		nested_assignments(*expr.as<Expr::Grouping>().expression, false, assignments);
+	}
+	else if (expr.is<Expr::Call>())
+	{
+		for (auto& arg : expr.as<Expr::Call>().arguments)
+		{
+			nested_assignments(*arg, false, assignments);
+		}
+	}
+	else if (expr.is<Expr::DeviceLoad>())
+	{
+		nested_assignments(*expr.as<Expr::DeviceLoad>().device, false, assignments);
+	}
+}
+
+void Propagation::propagate(std::vector<std::unique_ptr<Stmt>>& statements, Facts& facts)
+{
+	for (auto& stmt : statements)
+	{
+		this->propagate(stmt, facts);
+	}
+}
+
+void Propagation::propagate(std::unique_ptr<Stmt>& stmt, Facts& facts)
+{
+	if (stmt->is<Stmt::Block>())
+	{
+		// a block runs straight through, so what is known at its end is still known after it
+		this->propagate(stmt->as<Stmt::Block>().statements, facts);
+		return;
+	}
+	if (stmt->is<Stmt::If>())
+	{
+		Stmt::If& branch = stmt->as<Stmt::If>();
+		this->substitute(branch.condition, facts);
+		Facts if_true = facts;
+		this->propagate(branch.branch_true, if_true);
+		if (branch.branch_false)
+		{
+			Facts if_false = facts;
+			this->propagate(branch.branch_false, if_false);
+		}
+		facts.clear();
+		return;
+	}
+	if (stmt->is<Stmt::While>())
+	{
+		// the body is entered again from its own end, where nothing from before the loop holds
+		Facts body;
+		this->propagate(stmt->as<Stmt::While>().body, body);
+		facts.clear();
+		return;
+	}
+	std::vector<std::shared_ptr<Expr>*> roots;
+	// the value the statement gives to a variable, and which one
+	std::shared_ptr<Expr>* written = nullptr;
+	SymbolTable::Index target = SymbolTable::Invalid;
+	if (stmt->is<Stmt::Expression>())
+	{
+		std::shared_ptr<Expr>& expression = stmt->as<Stmt::Expression>().expression;
+		roots.push_back(&expression);
+		if (expression->is<Expr::Assignment>())
+		{
+			written = &expression->as<Expr::Assignment>().value;
+			target = this->program.table.lookup_index(expression);
+		}
+	}
+	else if (stmt->is<Stmt::Variable>())
+	{
+		roots.push_back(&stmt->as<Stmt::Variable>().initalizer);
+		written = &stmt->as<Stmt::Variable>().initalizer;
+		target = this->program.table.lookup_index(stmt);
+	}
+	else if (stmt->is<Stmt::Print>())
+	{
+		roots.push_back(&stmt->as<Stmt::Print>().expression);
+	}
+	else if (stmt->is<Stmt::Return>())
+	{
+		if (stmt->as<Stmt::Return>().value)
+		{
+			roots.push_back(&stmt->as<Stmt::Return>().value);
+		}
+	}
+	else if (stmt->is<Stmt::DeviceSet>())
+	{
+		roots.push_back(&stmt->as<Stmt::DeviceSet>().device);
+		roots.push_back(&stmt->as<Stmt::DeviceSet>().value);
+	}
+	std::vector<Expr*> assignments;
+	for (std::shared_ptr<Expr>* root : roots)
+	{
+		nested_assignments(**root, true, assignments);
+	}
+	// it is not clear which reads in the statement come before such an assignment
+	for (Expr* assignment : assignments)
+	{
+		facts.erase(this->program.table.lookup_index(assignment));
+	}
+	for (std::shared_ptr<Expr>* root : roots)
+	{
+		this->substitute(*root, facts);
+	}
+	if (target != SymbolTable::Invalid)
+	{
+		const auto& found = this->locals.find(target);
+		std::shared_ptr<Expr>& value = expr_util::unwrap(*written);
+		if (found != this->locals.end() && !found->second.pinned && value->is<Expr::Literal>())
+		{
+			facts[target] = value;
+		}
+		else
+		{
+			facts.erase(target);
+		}
+	}
+	if (stmt->is<Stmt::Return>())
+	{
+		facts.clear();
+	}
+}
+
+void Propagation::substitute(std::shared_ptr<Expr>& expr, const Facts& facts)
+{
+	if (expr->is<Expr::Variable>())
+	{
+		const auto& found = facts.find(this->program.table.lookup_index(expr));
+		if (found != facts.end())
+		{
+			this->replace(expr, found->second->clone());
+			this->replaced++;
+		}
+	}
+	else if (expr->is<Expr::Assignment>())
+	{
+		this->substitute(expr->as<Expr::Assignment>().value, facts);
+	}
+	else if (expr->is<Expr::Unary>())
+	{
+		// an address has to stay the address of the variable
+		if (expr->as<Expr::Unary>().op.type != TokenType::AMPERSAND)
+		{
+			this->substitute(expr->as<Expr::Unary>().right, facts);
+		}
+	}
+	else if (expr->is<Expr::Binary>())
+	{
+		this->substitute(expr->as<Expr::Binary>().left, facts);
+		this->substitute(expr->as<Expr::Binary>().right, facts);
+	}
+	else if (expr->is<Expr::Logical>())
+	{
+		this->substitute(expr->as<Expr::Logical>().left, facts);
+		this->substitute(expr->as<Expr::Logical>().right, facts);
+	}
+	else if (expr->is<Expr::Select>())
+	{
+		this->substitute(expr->as<Expr::Select>().condition, facts);
+		this->substitute(expr->as<Expr::Select>().if_true, facts);
+		this->substitute(expr->as<Expr::Select>().if_false, facts);
+	}
+	else if (expr->is<Expr::Grouping>())
+	{
+		this->substitute(expr->as<Expr::Grouping>().expression, facts);
+	}
+	else if (expr->is<Expr::Call>())
+	{
+		for (auto& arg : expr->as<Expr::Call>().arguments)
+		{
+			this->substitute(arg, facts);
+		}
+	}
+	else if (expr->is<Expr::DeviceLoad>())
+	{
+		this->substitute(expr->as<Expr::DeviceLoad>().device, facts);
+	}
+}
+
+void Propagation::propagate_declarations()
+{
+	// declarations come before their reads, so a copy of a copy already reads the original here
+	for (SymbolTable::Index index : this->order)
+	{
+		Local& local = this->locals.at(index);
+		if (!local.declaration || local.pinned || local.writes.size() || !local.reads.size())
+		{
+			continue;
+		}
+		std::shared_ptr<Expr>& value = expr_util::unwrap(local.declaration->initalizer);
+		if (value->is<Expr::Literal>())
+		{
+			for (std::shared_ptr<Expr>* read : local.reads)
+			{
+				this->replace(*read, value->clone());
+				this->replaced++;
+			}
+			this->compiler.info(std::string("Propagated ") + local.name + " = " + value->as<Expr::Literal>().literal.literal.to_lexeme() +
+				" into " + std::to_string(local.reads.size()) + " reads");
+			local.reads.clear();
+			continue;
+		}
+		if (!value->is<Expr::Variable>())
+		{
+			continue;
+		}
+		SymbolTable::Index source_index = this->program.table.lookup_index(value);
+		const auto& found = this->locals.find(source_index);
+		// the copy is read by name, which has to mean the same variable wherever it is read
+		if (found == this->locals.end() || found->second.pinned || found->second.writes.size() || this->declarations[found->second.name] != 1)
+		{
+			continue;
+		}
+		Local& source = found->second;
+		for (std::shared_ptr<Expr>* read : local.reads)
+		{
+			std::shared_ptr<Expr::Variable> copy = std::make_shared<Expr::Variable>(Token((*read)->as<Expr::Variable>().name.line, TokenType::IDENTIFIER, source.name));
+			copy->type = (*read)->type;
+			this->program.table.alias_symbol(source_index, SymbolUseNode(copy.get(), UseLocation::During));
+			this->replace(*read, copy);
+			source.reads.push_back(read);
+			this->replaced++;
+		}
+		this->compiler.info(std::string("Propagated copy ") + local.name + " = " + source.name + " into " + std::to_string(local.reads.size()) + " reads");
+		local.reads.clear();
+	}
+}
+
+bool Propagation::remove_dead_stores()
+{
+	bool changed = false;
+	for (SymbolTable::Index index : this->order)
+	{
+		Local& local = this->locals.at(index);
+		if (local.pinned || local.reads.size() || (!local.declaration && !local.writes.size()))
+		{
+			continue;
+		}
+		// an assignment evaluates to its value, which may still be used or do something
+		for (std::shared_ptr<Expr>* write : local.writes)
+		{
+			this->replace(*write, (*write)->as<Expr::Assignment>().value);
+		}
+		if (local.declaration)
+		{
+			std::shared_ptr<Expr> initalizer = local.declaration->initalizer;
+			if (expr_util::has_effects(*initalizer))
+			{
+				this->replace(*local.holder, std::make_unique<Stmt::Expression>(initalizer));
+			}
+			else
+			{
+				this->replace(*local.holder, std::make_unique<Stmt::NoOp>());
+			}
+		}
+		this->compiler.info(std::string("Removed ") + local.name + ", which is never read");
+		this->removed++;
+		changed = true;
+	}
+	if (changed)
+	{
+		for (auto& stmt : this->function->body)
+		{
+			this->remove_pure_statements(stmt);
+		}
+	}
+	return changed;
+}
+
+void Propagation::remove_pure_statements(std::unique_ptr<Stmt>& stmt)
+{
+	if (stmt->is<Stmt::Expression>() && !expr_util::has_effects(*stmt->as<Stmt::Expression>().expression))
+	{
+		this->replace(stmt, std::make_unique<Stmt::NoOp>());
+	}
+	else if (stmt->is<Stmt::Block>())
+	{
+		for (auto& statement : stmt->as<Stmt::Block>().statements)
+		{
+			this->remove_pure_statements(statement);
+		}
+	}
+	else if (stmt->is<Stmt::If>())
+	{
+		this->remove_pure_statements(stmt->as<Stmt::If>().branch_true);
+		if (stmt->as<Stmt::If>().branch_false)
+		{
+			this->remove_pure_statements(stmt->as<Stmt::If>().branch_false);
+		}
+	}
+	else if (stmt->is<Stmt::While>())
+	{
+		this->remove_pure_statements(stmt->as<Stmt::While>().body);
+	}
+}
+
+void Propagation::replace(std::shared_ptr<Expr>& site, std::shared_ptr<Expr> value)
+{
+	this->retired_expressions.push_back(site);
+	site = value;
+}
+
+void Propagation::replace(std::unique_ptr<Stmt>& site, std::unique_ptr<Stmt> value)
+{
+	this->retired_statements.push_back(std::move(site));
+	site = std::move(value);
+}
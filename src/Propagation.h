@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// Replaces reads of locals and parameters whose value is known, then removes the locals nothing reads anymore.
+// Within straight-line code a variable holds the literal it was last given until it is written again.
+// A local that is never written after its declaration is replaced everywhere by the literal it is
+// initialized with, or by the variable it copies when that one is never written either.
+// Variables are told apart by the symbol table, so it works on a checked program, which has to be checked
+// again once anything changed.
+class Propagation
+{
+public:
+	Propagation(Compiler& compiler, TypeCheckedProgram& program);
+
+	// returns whether anything was replaced or removed
+	bool run();
+private:
+	struct Local
+	{
+		std::string name;
+		// null for parameters
+		Stmt::Variable* declaration = nullptr;
+		std::unique_ptr<Stmt>* holder = nullptr;
+		std::vector<std::shared_ptr<Expr>*> reads;
+		// the assignments to it
+		std::vector<std::shared_ptr<Expr>*> writes;
+		// read or written by asm or has its address taken, so it has to stay where it is
+		bool pinned = false;
+	};
+	// the literal each variable is known to hold
+	typedef std::unordered_map<SymbolTable::Index, std::shared_ptr<Expr>> Facts;
+
+	void process(Stmt::Function& function);
+	void collect(Stmt::Function& function);
+	void collect(std::unique_ptr<Stmt>& stmt);
+	void collect(std::shared_ptr<Expr>& expr);
+	// the entry for a local or parameter of the function being processed, null for anything else
+	Local* local(SymbolTable::Index index, const std::string& name);
+
+	void propagate(std::vector<std::unique_ptr<Stmt>>& statements, Facts& facts);
+	void propagate(std::unique_ptr<Stmt>& stmt, Facts& facts);
+	void substitute(std::shared_ptr<Expr>& expr, const Facts& facts);
+	void propagate_declarations();
+	bool remove_dead_stores();
+	void remove_pure_statements(std::unique_ptr<Stmt>& stmt);
+
+	void replace(std::shared_ptr<Expr>& site, std::shared_ptr<Expr> value);
+	void replace(std::unique_ptr<Stmt>& site, std::unique_ptr<Stmt> value);
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	int replaced;
+	int removed;
+
+	Stmt::Function* function;
+	// locals and parameters of the function being processed, in the order they are declared
+	std::unordered_map<SymbolTable::Index, Local> locals;
+	std::vector<SymbolTable::Index> order;
+	std::unordered_map<std::string, int> declarations;
+	std::unordered_set<std::string> in_asm;
+	// the table keys on node addresses, so nothing this pass replaces may be freed while it runs
+	std::vector<std::shared_ptr<Expr>> retired_expressions;
+	std::vector<std::unique_ptr<Stmt>> retired_statements;
+};
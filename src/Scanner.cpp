@@ -26,6 +26,7 @@ std::unordered_map<std::string, TokenType> Scanner::keywords = {
 	{"nodiscard", TokenType::NODISCARD},
 	{"static", TokenType::STATIC},
 	{"dload", TokenType::DLOAD},
+	{"stable", TokenType::STABLE},
 	{"dset", TokenType::DSET},
 	{"fixed", TokenType::FIXED}
 };
@@ -231,6 +232,7 @@ void Scanner::scan_token()
 		CHECK_SINGLE_TOKEN('+', TokenType::PLUS);
 		CHECK_SINGLE_TOKEN(';', TokenType::SEMICOLON);
 		CHECK_SINGLE_TOKEN('*', TokenType::STAR);
+		CHECK_SINGLE_TOKEN('/', TokenType::SLASH);
 		CHECK_SINGLE_TOKEN('&', TokenType::AMPERSAND);
 		CHECK_SINGLE_TOKEN('|', TokenType::BAR);
 		CHECK_SINGLE_TOKEN('?', TokenType::QUESTION);
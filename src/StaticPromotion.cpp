@@ -0,0 +1,277 @@
+#include <algorithm>
+
+#include "StaticPromotion.h"
+#include "Compiler.h"
+#include "ExprUtil.h"
+
+StaticPromotion::StaticPromotion(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program)
+{}
+
+void StaticPromotion::run()
+{
+	std::vector<std::unique_ptr<Stmt>>& statements = this->program.statements();
+	for (auto& stmt : statements)
+	{
+		if (!stmt->is<Stmt::Static>())
+		{
+			continue;
+		}
+		Stmt::Static& declaration = stmt->as<Stmt::Static>();
+		SymbolTable::Index index = this->program.table.lookup_index(declaration.var);
+		if (index == SymbolTable::Invalid)
+		{
+			continue;
+		}
+		Static& value = this->statics[index];
+		value.name = declaration.var->as<Stmt::Variable>().name.lexeme;
+		value.declaration = &declaration;
+		value.holder = &stmt;
+		this->order.push_back(index);
+	}
+	for (auto& stmt : statements)
+	{
+		this->collect(stmt);
+	}
+	std::vector<Static*> written;
+	for (SymbolTable::Index index : this->order)
+	{
+		Static& value = this->statics.at(index);
+		if (value.pinned || this->fold(value) || this->remove_unused(value))
+		{
+			continue;
+		}
+		written.push_back(&value);
+	}
+	std::stable_sort(written.begin(), written.end(), [](const Static* a, const Static* b)
+		{
+			return a->reads.size() + a->writes.size() > b->reads.size() + b->writes.size();
+		});
+	for (size_t i = 0; i < written.size() && i < max_static_registers; i++)
+	{
+		written[i]->declaration->in_register = true;
+		this->compiler.info(std::string("Keeping static ") + written[i]->name + " in a register");
+	}
+	statements.erase(std::remove(statements.begin(), statements.end(), nullptr), statements.end());
+}
+
+bool StaticPromotion::fold(Static& value)
+{
+	std::shared_ptr<Expr>& initalizer = expr_util::unwrap(value.declaration->var->as<Stmt::Variable>().initalizer);
+	if (!initalizer->is<Expr::Literal>())
+	{
+		return false;
+	}
+	const Literal& literal = initalizer->as<Expr::Literal>().literal.literal;
+	// assigning the value it already has changes nothing
+	for (std::shared_ptr<Expr>* write : value.writes)
+	{
+		std::shared_ptr<Expr>& assigned = expr_util::unwrap((*write)->as<Expr::Assignment>().value);
+		if (!assigned->is<Expr::Literal>())
+		{
+			return false;
+		}
+		const Literal& other = assigned->as<Expr::Literal>().literal.literal;
+		if (other.type() != literal.type() || other.to_lexeme() != literal.to_lexeme())
+		{
+			return false;
+		}
+	}
+	for (std::shared_ptr<Expr>* write : value.writes)
+	{
+		this->reduce_to_value(*write);
+	}
+	for (std::shared_ptr<Expr>* read : value.reads)
+	{
+		int line = (*read)->as<Expr::Variable>().name.line;
+		this->replace(*read, std::make_shared<Expr::Literal>(Token(line, literal.type(), literal.to_lexeme(), literal)));
+	}
+	this->compiler.info(std::string("Promoted static ") + value.name + " = " + literal.to_lexeme() + " to a constant");
+	if (!value.read_by_asm)
+	{
+		this->retired_statements.push_back(std::move(*value.holder));
+	}
+	return true;
+}
+
+bool StaticPromotion::remove_unused(Static& value)
+{
+	if (value.reads.size() || value.read_by_asm || expr_util::has_effects(*value.declaration->var->as<Stmt::Variable>().initalizer))
+	{
+		return false;
+	}
+	// the assignments are dead stores, what they assign may still do something
+	for (std::shared_ptr<Expr>* write : value.writes)
+	{
+		this->reduce_to_value(*write);
+	}
+	this->compiler.info(std::string("Removed static ") + value.name + ", which is never read");
+	this->retired_statements.push_back(std::move(*value.holder));
+	return true;
+}
+
+StaticPromotion::Static* StaticPromotion::find(const void* node)
+{
+	const auto& found = this->statics.find(this->program.table.lookup_index(node));
+	return found == this->statics.end() ? nullptr : &found->second;
+}
+
+void StaticPromotion::collect(std::unique_ptr<Stmt>& stmt)
+{
+	if (stmt->is<Stmt::Static>())
+	{
+		this->collect(stmt->as<Stmt::Static>().var);
+	}
+	else if (stmt->is<Stmt::Function>())
+	{
+		for (auto& statement : stmt->as<Stmt::Function>().body)
+		{
+			this->collect(statement);
+		}
+	}
+	else if (stmt->is<Stmt::Variable>())
+	{
+		this->collect(stmt->as<Stmt::Variable>().initalizer);
+	}
+	else if (stmt->is<Stmt::Expression>())
+	{
+		this->collect(stmt->as<Stmt::Expression>().expression);
+	}
+	else if (stmt->is<Stmt::Print>())
+	{
+		this->collect(stmt->as<Stmt::Print>().expression);
+	}
+	else if (stmt->is<Stmt::Return>())
+	{
+		if (stmt->as<Stmt::Return>().value)
+		{
+			this->collect(stmt->as<Stmt::Return>().value);
+		}
+	}
+	else if (stmt->is<Stmt::DeviceSet>())
+	{
+		this->collect(stmt->as<Stmt::DeviceSet>().device);
+		this->collect(stmt->as<Stmt::DeviceSet>().value);
+	}
+	else if (stmt->is<Stmt::If>())
+	{
+		Stmt::If& branch = stmt->as<Stmt::If>();
+		this->collect(branch.condition);
+		this->collect(branch.branch_true);
+		if (branch.branch_false)
+		{
+			this->collect(branch.branch_false);
+		}
+	}
+	else if (stmt->is<Stmt::While>())
+	{
+		this->collect(stmt->as<Stmt::While>().condition);
+		this->collect(stmt->as<Stmt::While>().body);
+	}
+	else if (stmt->is<Stmt::Block>())
+	{
+		for (auto& statement : stmt->as<Stmt::Block>().statements)
+		{
+			this->collect(statement);
+		}
+	}
+	else if (stmt->is<Stmt::Asm>())
+	{
+		// asm refers to variables by name, so a static with the name may be the one meant
+		for (const auto& reference : stmt->as<Stmt::Asm>().referenced_variables())
+		{
+			bool store = reference.size() > 1 && reference[1] == '&';
+			std::string name = reference.substr(store ? 2 : 1);
+			for (auto& value : this->statics)
+			{
+				if (value.second.name == name)
+				{
+					value.second.read_by_asm = true;
+					value.second.pinned = value.second.pinned || store;
+				}
+			}
+		}
+	}
+}
+
+void StaticPromotion::collect(std::shared_ptr<Expr>& expr)
+{
+	if (expr->is<Expr::Variable>())
+	{
+		if (Static* value = this->find(expr.get()))
+		{
+			value->reads.push_back(&expr);
+		}
+	}
+	else if (expr->is<Expr::Assignment>())
+	{
+		this->collect(expr->as<Expr::Assignment>().value);
+		if (Static* value = this->find(expr.get()))
+		{
+			value->writes.push_back(&expr);
+		}
+	}
+	else if (expr->is<Expr::Unary>())
+	{
+		Expr::Unary& unary = expr->as<Expr::Unary>();
+		if (unary.op.type == TokenType::AMPERSAND && unary.right->is<Expr::Variable>())
+		{
+			if (Static* value = this->find(unary.right.get()))
+			{
+				value->pinned = true;
+			}
+		}
+		this->collect(unary.right);
+	}
+	else if (expr->is<Expr::Binary>())
+	{
+		this->collect(expr->as<Expr::Binary>().left);
+		this->collect(expr->as<Expr::Binary>().right);
+	}
+	else if (expr->is<Expr::Logical>())
+	{
+		this->collect(expr->as<Expr::Logical>().left);
+		this->collect(expr->as<Expr::Logical>().right);
+	}
+	else if (expr->is<Expr::Select>())
+	{
+		this->collect(expr->as<Expr::Select>().condition);
+		this->collect(expr->as<Expr::Select>().if_true);
+		this->collect(expr->as<Expr::Select>().if_false);
+	}
+	else if (expr->is<Expr::Grouping>())
+	{
+		this->collect(expr->as<Expr::Grouping>().expression);
+	}
+	else if (expr->is<Expr::Call>())
+	{
+		for (auto& arg : expr->as<Expr::Call>().arguments)
+		{
+			this->collect(arg);
+		}
+	}
+	else if (expr->is<Expr::DeviceLoad>())
+	{
+		this->collect(expr->as<Expr::DeviceLoad>().device);
+	}
+}
+
+void StaticPromotion::replace(std::shared_ptr<Expr>& site, std::shared_ptr<Expr> value)
+{
+	this->retired_expressions.push_back(site);
+	site = value;
+}
+
+void StaticPromotion::reduce_to_value(std::shared_ptr<Expr>& write)
+{
+	std::shared_ptr<Expr>& assigned = write->as<Expr::Assignment>().value;
+	// a static read or written right at the top of the value moves out of the assignment with it
+	for (auto& entry : this->statics)
+	{
+		for (std::vector<std::shared_ptr<Expr>*>* sites : { &entry.second.reads, &entry.second.writes })
+		{
+			std::replace(sites->begin(), sites->end(), &assigned, &write);
+		}
+	}
+	this->replace(write, assigned);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// Every read of a static costs a trip to the bottom of the stack, so statics are taken off it where possible.
+// A static that is never assigned, or only ever assigned the literal it starts with, is replaced by that literal
+// and its declaration is removed. A static nothing reads is removed too, its assignments reduced to the values they
+// assign. Of the statics that are left, the most used ones are marked to be kept in
+// registers of their own, which the code generator takes out of every function's pool.
+// Works on a checked program before it is optimized, so the literals are folded along with everything else.
+class StaticPromotion
+{
+public:
+	StaticPromotion(Compiler& compiler, TypeCheckedProgram& program);
+
+	void run();
+private:
+	// registers taken from the locals of every function
+	static constexpr int max_static_registers = 2;
+
+	struct Static
+	{
+		std::string name;
+		Stmt::Static* declaration = nullptr;
+		std::unique_ptr<Stmt>* holder = nullptr;
+		std::vector<std::shared_ptr<Expr>*> reads;
+		std::vector<std::shared_ptr<Expr>*> writes;
+		// read by asm, which needs the declaration to stay
+		bool read_by_asm = false;
+		// written by asm or has its address taken
+		bool pinned = false;
+	};
+
+	void collect(std::unique_ptr<Stmt>& stmt);
+	void collect(std::shared_ptr<Expr>& expr);
+	Static* find(const void* node);
+	bool fold(Static& value);
+	bool remove_unused(Static& value);
+
+	void replace(std::shared_ptr<Expr>& site, std::shared_ptr<Expr> value);
+	// replaces an assignment with the value it assigns
+	void reduce_to_value(std::shared_ptr<Expr>& write);
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	std::unordered_map<SymbolTable::Index, Static> statics;
+	// in the order they are declared
+	std::vector<SymbolTable::Index> order;
+	// the table keys on node addresses, so nothing this pass replaces may be freed while it runs
+	std::vector<std::shared_ptr<Expr>> retired_expressions;
+	std::vector<std::unique_ptr<Stmt>> retired_statements;
+};
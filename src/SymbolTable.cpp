@@ -1,3 +1,5 @@
+#include <limits>
+
 #include "SymbolTable.h"
 
 SymbolTable::Index SymbolTable::Invalid = std::numeric_limits<SymbolTable::Index>::max();
@@ -121,12 +123,29 @@ SymbolTable::Index SymbolTable::create_symbol(SymbolUseNode inital, const Variab
 	this->symbols.push_back(Symbol(inital, var));
 	Index i = this->symbols.size() - 1;
 	this->name_to_symbol.emplace(inital.id(), i);
+	this->variable_to_symbol.emplace(var, i);
 	return i;
 }
 
+SymbolTable::Index SymbolTable::size() const
+{
+	return this->symbols.size();
+}
+
+SymbolTable::Index SymbolTable::lookup_variable_index(const Variable* var) const
+{
+	auto it = this->variable_to_symbol.find(var);
+	if (it == this->variable_to_symbol.end())
+	{
+		return this->Invalid;
+	}
+	return it->second;
+}
+
 void SymbolTable::alias_symbol(Index symbol, SymbolUseNode alias)
 {
-	this->name_to_symbol.emplace(alias.id(), symbol);
+	// a node made for the alias can take the address of one freed earlier, whose entry is stale
+	this->name_to_symbol.insert_or_assign(alias.id(), symbol);
 }
 
 SymbolTable::Index SymbolTable::lookup_index(const void* ast_node)
@@ -71,6 +71,8 @@ public:
 	
 	Index create_symbol(SymbolUseNode inital, const Variable* var);
 	void alias_symbol(Index symbol, SymbolUseNode alias);
+	Index size() const;
+	Index lookup_variable_index(const Variable* var) const;
 	Index lookup_index(const void* ast_node);
 	Index lookup_index(const std::unique_ptr<Stmt>& ast_node);
 	Index lookup_index(const std::shared_ptr<Expr>& ast_node);
@@ -81,5 +83,7 @@ public:
 private:
 	std::vector<Symbol> symbols;
 	std::unordered_map<const void*, Index> name_to_symbol;
+	// parameters share their function as a definition node, so variables are indexed separately
+	std::unordered_map<const Variable*, Index> variable_to_symbol;
 };
 
@@ -1,5 +1,24 @@
 #include "Token.h"
 
+#include <cstdio>
+#include <cstdlib>
+
+// the fewest decimals that read back as the same number, so folded constants survive being printed
+static std::string number_string(double number)
+{
+	char buffer[128];
+	for (int decimals = 1; decimals <= 64; decimals++)
+	{
+		std::snprintf(buffer, sizeof(buffer), "%.*f", decimals, number);
+		if (std::strtod(buffer, nullptr) == number)
+		{
+			return buffer;
+		}
+	}
+	std::snprintf(buffer, sizeof(buffer), "%.17g", number);
+	return buffer;
+}
+
 Literal::Literal()
 	:number(nullptr), string(nullptr), boolean(nullptr), string_hashed(false)
 {}
@@ -112,7 +131,7 @@ std::string Literal::to_value_string() const
 		{
 			return std::to_string(this->as_integer());
 		}
-		return std::to_string(this->as_number());
+		return number_string(this->as_number());
 	}
 	if (this->is_boolean())
 	{
@@ -207,7 +226,7 @@ std::string Literal::to_lexeme() const
 		{
 			return std::to_string(this->as_integer());
 		}
-		return std::to_string(this->as_number());
+		return number_string(this->as_number());
 	}
 	if (this->is_boolean())
 	{
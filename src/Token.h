@@ -56,6 +56,7 @@ enum class TokenType
 	ASM,
 	PRINT,
 	DLOAD,
+	STABLE,
 	DSET,
 
 	T_EOF
@@ -573,35 +573,45 @@ void* TypeChecker::visitExprUnary(Expr::Unary& expr)
 }
 
 
-void TypeChecker::symbol_visit_expr_variable(Expr::Variable& expr, const Variable* info)
+void TypeChecker::symbol_visit_use(SymbolUseNode use, const Variable* info)
 {
-	SymbolTable::Index i = this->program.table.lookup_index(info->def().id());
-	SymbolUseNode use = SymbolUseNode(expr.downcast(), UseLocation::During);
+	SymbolTable::Index i = this->program.table.lookup_variable_index(info);
+	if (i == SymbolTable::Invalid)
+	{
+		// functions are not symbols
+		return;
+	}
 	Symbol& sym = this->program.table.lookup(i);
-	this->program.table.alias_symbol(i, use);
-	if (this->block_parent && this->block_parent->is<Stmt::While>())
-	{
-		// TODO:
-		/*
-		number x = 0;
-		number y = 0;
-		while (y < 5)
+	// a variable defined outside of a loop must stay alive until the outermost such loop exits
+	for (const auto& loop : this->enclosing_loops)
+	{
+		if (i < loop.second)
 		{
-			y = y + 1;
-			x = 0;
-			while (x < 5)
-			{
-				x = x + y;
-			} <- detected last use of y
-		} when y's last use should be here
-		may cause register churn, but should be ?fine?
-		*/
-		sym.set_end(SymbolUseNode(this->block_parent, UseLocation::AfterStatement));
+			sym.set_end(SymbolUseNode(loop.first, UseLocation::AfterStatement));
+			return;
+		}
 	}
-	else
+	sym.set_end(use);
+}
+
+void TypeChecker::symbol_visit_expr_variable(Expr::Variable& expr, const Variable* info)
+{
+	SymbolTable::Index i = this->program.table.lookup_variable_index(info);
+	if (i != SymbolTable::Invalid)
+	{
+		this->program.table.alias_symbol(i, SymbolUseNode(expr.downcast(), UseLocation::During));
+	}
+	this->symbol_visit_use(SymbolUseNode(expr.downcast(), UseLocation::During), info);
+}
+
+void TypeChecker::symbol_visit_expr_assignment(Expr::Assignment& expr, const Variable* info)
+{
+	SymbolTable::Index i = this->program.table.lookup_variable_index(info);
+	if (i != SymbolTable::Invalid)
 	{
-		sym.set_end(use);
+		this->program.table.alias_symbol(i, SymbolUseNode(expr.downcast(), UseLocation::During));
 	}
+	this->symbol_visit_use(SymbolUseNode(expr.downcast(), UseLocation::During), info);
 }
 
 void TypeChecker::symbol_visit_stmt_variable(Stmt::Variable& stmt, const Variable* info)
@@ -717,6 +727,7 @@ void* TypeChecker::visitExprAssignment(Expr::Assignment& expr)
 			" and value is of type " + value_type->type_name());
 		return nullptr;
 	}
+	this->symbol_visit_expr_assignment(expr, info);
 	expr.type = *value_type;
 	return value_type.release();
 }
@@ -814,7 +825,7 @@ void* TypeChecker::visitExprLogical(Expr::Logical& expr)
 	{
 		return nullptr;
 	}
-	if (!left_type->const_unqualified_equals(this->t_void) || !right_type->const_unqualified_equals(this->t_boolean))
+	if (!left_type->const_unqualified_equals(this->t_boolean) || !right_type->const_unqualified_equals(this->t_boolean))
 	{
 		this->error(expr.op, std::string("Attempted to logically compare ") + left_type->type_name() + " with " +
 			right_type->type_name() + " (requires boolean operations)");
@@ -824,6 +835,25 @@ void* TypeChecker::visitExprLogical(Expr::Logical& expr)
 	return left_type.release();
 }
 
+void* TypeChecker::visitExprSelect(Expr::Select& expr)
+{
+	std::unique_ptr<TypeName> condition_type = this->accept(*expr.condition);
+	std::unique_ptr<TypeName> true_type = this->accept(*expr.if_true);
+	std::unique_ptr<TypeName> false_type = this->accept(*expr.if_false);
+	if (!condition_type || !true_type || !false_type)
+	{
+		return nullptr;
+	}
+	if (!condition_type->const_unqualified_equals(this->t_boolean) || !true_type->const_unqualified_equals(*false_type))
+	{
+		this->error(expr.token, std::string("Attempted to select between ") + true_type->type_name() + " and " +
+			false_type->type_name() + " on " + condition_type->type_name() + " (requires a boolean condition and matching values)");
+		return nullptr;
+	}
+	expr.type = *true_type;
+	return true_type.release();
+}
+
 bool TypeChecker::is_intrinsic(const TypeName& type)
 {
 	return type.const_unqualified_equals(TypeChecker::t_number) ||
@@ -880,6 +910,15 @@ void* TypeChecker::visitStmtAsm(Stmt::Asm& stmt)
 	{
 		return nullptr;
 	}
+	for (const auto& reference : stmt.referenced_variables())
+	{
+		std::string name = reference.substr(reference.size() > 1 && reference[1] == '&' ? 2 : 1);
+		const Variable* info = this->env->get_variable(name);
+		if (info)
+		{
+			this->symbol_visit_use(SymbolUseNode(stmt.downcast(), UseLocation::During), info);
+		}
+	}
 	return nullptr;
 }
 
@@ -953,9 +992,7 @@ void* TypeChecker::visitStmtBlock(Stmt::Block& stmt)
 		return nullptr;
 	}
 	this->env = this->env->spawn(&stmt);
-	Stmt* last_parent = this->block_parent;
 	this->evaluate(stmt.statements);
-	this->block_parent = last_parent;
 	this->env = this->env->get_parent();
 	return nullptr;
 }
@@ -966,18 +1003,15 @@ void* TypeChecker::visitStmtWhile(Stmt::While& expr)
 	{
 		return nullptr;
 	}
+	// the condition is evaluated on every iteration, so it is inside the loop too
+	this->enclosing_loops.push_back({ expr.downcast(), this->program.table.size() });
 	std::unique_ptr<TypeName> condition_type = this->accept(*expr.condition);
-	if (!condition_type)
-	{
-		expr.body->accept(*this);
-		return nullptr;
-	}
-	if (!condition_type->const_unqualified_equals(this->t_boolean))
+	if (condition_type && !condition_type->const_unqualified_equals(this->t_boolean))
 	{
 		this->error(expr.token, "Attempted to loop on a non-boolean condition.");
 	}
-	this->block_parent = expr.downcast();
 	expr.body->accept(*this);
+	this->enclosing_loops.pop_back();
 	return nullptr;
 }
 
@@ -990,11 +1024,9 @@ void* TypeChecker::visitStmtIf(Stmt::If& stmt)
 	std::unique_ptr<TypeName> condition_type = this->accept(*stmt.condition);
 	if (!condition_type)
 	{
-		this->block_parent = stmt.downcast();
 		stmt.branch_true->accept(*this);
 		if (stmt.branch_false)
 		{
-			this->block_parent = stmt.downcast();
 			stmt.branch_false->accept(*this);
 		}
 		return nullptr;
@@ -1005,11 +1037,9 @@ void* TypeChecker::visitStmtIf(Stmt::If& stmt)
 		this->error(stmt.token, "Attempted to branch on a non-boolean condition.");
 		had_error = true;
 	}
-	this->block_parent = stmt.downcast();
 	stmt.branch_true->accept(*this);
 	if (stmt.branch_false)
 	{
-		this->block_parent = stmt.downcast();
 		stmt.branch_false->accept(*this);
 	}
 	if (had_error)
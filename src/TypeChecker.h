@@ -174,6 +174,7 @@ public:
 	virtual void* visitExprAssignment(Expr::Assignment& expr) override;
 	virtual void* visitExprCall(Expr::Call& expr) override;
 	virtual void* visitExprLogical(Expr::Logical& expr) override;
+	virtual void* visitExprSelect(Expr::Select& expr) override;
 	virtual void* visitExprDeviceLoad(Expr::DeviceLoad& expr) override;
 
 	virtual void* visitStmtExpression(Stmt::Expression& stmt) override;
@@ -188,7 +189,9 @@ public:
 	virtual void* visitStmtStatic(Stmt::Static& expr) override;
 	virtual void* visitStmtDeviceSet(Stmt::DeviceSet& expr) override;
 
+	void symbol_visit_use(SymbolUseNode use, const Variable* info);
 	void symbol_visit_expr_variable(Expr::Variable& expr, const Variable* info);
+	void symbol_visit_expr_assignment(Expr::Assignment& expr, const Variable* info);
 	void symbol_visit_stmt_variable(Stmt::Variable& stmt, const Variable* info);
 
 	static TypeName t_number;
@@ -198,7 +201,8 @@ public:
 private:
 	bool seen_main = false;
 
-	Stmt* block_parent;
+	// loops currently being checked, with the number of symbols that existed when each was entered
+	std::vector<std::pair<Stmt*, SymbolTable::Index>> enclosing_loops;
 
 	TypeCheckedProgram program;
 	TypedEnvironment::Leaf* env;
@@ -0,0 +1,481 @@
+#include <algorithm>
+
+#include "ValueNumbering.h"
+#include "Compiler.h"
+#include "ExprUtil.h"
+
+ValueNumbering::ValueNumbering(Compiler& compiler, TypeCheckedProgram& program)
+	:compiler(compiler), program(program), reused(0)
+{}
+
+bool ValueNumbering::run()
+{
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Static>())
+		{
+			Stmt& var = *stmt->as<Stmt::Static>().var;
+			if (var.is<Stmt::Variable>())
+			{
+				this->statics.insert(var.as<Stmt::Variable>().name.lexeme);
+			}
+		}
+	}
+	for (auto& stmt : this->program.statements())
+	{
+		if (stmt->is<Stmt::Function>())
+		{
+			stmt->accept(*this);
+		}
+	}
+	return this->reused > 0;
+}
+
+void* ValueNumbering::visitStmtFunction(Stmt::Function& stmt)
+{
+	this->process(stmt.body);
+	return nullptr;
+}
+
+void* ValueNumbering::visitStmtBlock(Stmt::Block& stmt)
+{
+	this->process(stmt.statements);
+	return nullptr;
+}
+
+void* ValueNumbering::visitStmtIf(Stmt::If& stmt)
+{
+	stmt.branch_true->accept(*this);
+	if (stmt.branch_false)
+	{
+		stmt.branch_false->accept(*this);
+	}
+	return nullptr;
+}
+
+void* ValueNumbering::visitStmtWhile(Stmt::While& stmt)
+{
+	stmt.body->accept(*this);
+	return nullptr;
+}
+
+void ValueNumbering::process(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+	std::vector<Value> values;
+	for (size_t i = 0; i < statements.size(); i++)
+	{
+		this->number_statement(*statements[i], i, values);
+	}
+	this->reuse(statements, values);
+}
+
+// whether evaluating the expression calls anything or assigns below its top
+static void scan(Expr& expr, bool& calls, bool& assigns)
+{
+	if (expr.is<Expr::Call>())
+	{
+		calls = true;
+		for (auto& arg : expr.as<Expr::Call>().arguments)
+		{
+			scan(*arg, calls, assigns);
+		}
+	}
+	else if (expr.is<Expr::Assignment>())
+	{
+		assigns = true;
+		scan(*expr.as<Expr::Assignment>().value, calls, assigns);
+	}
+	else if (expr.is<Expr::Binary>())
+	{
+		scan(*expr.as<Expr::Binary>().left, calls, assigns);
+		scan(*expr.as<Expr::Binary>().right, calls, assigns);
+	}
+	else if (expr.is<Expr::Logical>())
+	{
+		scan(*expr.as<Expr::Logical>().left, calls, assigns);
+		scan(*expr.as<Expr::Logical>().right, calls, assigns);
+	}
+	else if (expr.is<Expr::Select>())
+	{
+		scan(*expr.as<Expr::Select>().condition, calls, assigns);
+		scan(*expr.as<Expr::Select>().if_true, calls, assigns);
+		scan(*expr.as<Expr::Select>().if_false, calls, assigns);
+	}
+	else if (expr.is<Expr::Unary>())
+	{
+		scan(*expr.as<Expr::Unary>().right, calls, assigns);
+	}
+	else if (expr.is<Expr::Grouping>())
+	{
+		scan(*expr.as<Expr::Grouping>().expression, calls, assigns);
+	}
+	else if (expr.is<Expr::DeviceLoad>())
+	{
+		scan(*expr.as<Expr::DeviceLoad>().device, calls, assigns);
+	}
+}
+
+void ValueNumbering::number_statement(Stmt& stmt, size_t index, std::vector<Value>& values)
+{
+	std::vector<std::shared_ptr<Expr>*> roots;
+	// the variable the statement declares or assigns, once its value is computed
+	std::string written;
+	if (stmt.is<Stmt::Expression>())
+	{
+		std::shared_ptr<Expr>& expression = stmt.as<Stmt::Expression>().expression;
+		if (expression->is<Expr::Assignment>())
+		{
+			written = expression->as<Expr::Assignment>().name.lexeme;
+			roots.push_back(&expression->as<Expr::Assignment>().value);
+		}
+		else
+		{
+			roots.push_back(&expression);
+		}
+	}
+	else if (stmt.is<Stmt::Variable>())
+	{
+		written = stmt.as<Stmt::Variable>().name.lexeme;
+		roots.push_back(&stmt.as<Stmt::Variable>().initalizer);
+	}
+	else if (stmt.is<Stmt::Print>())
+	{
+		roots.push_back(&stmt.as<Stmt::Print>().expression);
+	}
+	else if (stmt.is<Stmt::Return>())
+	{
+		if (stmt.as<Stmt::Return>().value)
+		{
+			roots.push_back(&stmt.as<Stmt::Return>().value);
+		}
+	}
+	else if (stmt.is<Stmt::DeviceSet>())
+	{
+		roots.push_back(&stmt.as<Stmt::DeviceSet>().device);
+		roots.push_back(&stmt.as<Stmt::DeviceSet>().value);
+	}
+	else if (stmt.is<Stmt::If>())
+	{
+		// the condition runs before either branch, so it still belongs to the run
+		roots.push_back(&stmt.as<Stmt::If>().condition);
+	}
+	bool calls = false;
+	bool assigns = false;
+	for (std::shared_ptr<Expr>* root : roots)
+	{
+		scan(**root, calls, assigns);
+	}
+	if (assigns)
+	{
+		// an assignment in the middle of an expression changes a variable while its values are still being computed
+		kill_all(values);
+		return;
+	}
+	if (calls)
+	{
+		this->kill_calls(values);
+	}
+	int top = -1;
+	for (std::shared_ptr<Expr>* root : roots)
+	{
+		top = this->number(*root, index, calls, false, values);
+	}
+	if (written.size())
+	{
+		this->kill(values, written);
+		if (top >= 0 && roots.size() == 1 && values[top].valid)
+		{
+			values[top].holder = written;
+			values[top].reads.insert(written);
+		}
+	}
+	if (calls)
+	{
+		this->kill_calls(values);
+	}
+	if (stmt.is<Stmt::DeviceSet>())
+	{
+		kill_devices(values);
+	}
+	if (!stmt.is<Stmt::Expression>() && !stmt.is<Stmt::Variable>() && !stmt.is<Stmt::Print>() && !stmt.is<Stmt::DeviceSet>() && !stmt.is<Stmt::NoOp>())
+	{
+		// branches, loops, asm and returns end the run
+		stmt.accept(*this);
+		kill_all(values);
+	}
+}
+
+int ValueNumbering::number(std::shared_ptr<Expr>& expr, size_t index, bool calls, bool conditional, std::vector<Value>& values)
+{
+	if (expr->is<Expr::Grouping>())
+	{
+		return this->number(expr->as<Expr::Grouping>().expression, index, calls, conditional, values);
+	}
+	std::string key;
+	std::unordered_set<std::string> reads;
+	bool device = false;
+	bool candidate = expr_util::is_computed_value(*expr) && this->key_of(*expr, key, reads, device);
+	if (candidate && calls)
+	{
+		// the call may run before or after this is computed, and can change statics and devices
+		candidate = !device && std::none_of(reads.begin(), reads.end(), [this](const std::string& name) { return this->statics.count(name) > 0; });
+	}
+	if (candidate)
+	{
+		for (Value& value : values)
+		{
+			if (value.valid && value.key == key)
+			{
+				value.sites.push_back(&expr);
+				return -1;
+			}
+		}
+	}
+	if (expr->is<Expr::Binary>())
+	{
+		this->number(expr->as<Expr::Binary>().left, index, calls, conditional, values);
+		this->number(expr->as<Expr::Binary>().right, index, calls, conditional, values);
+	}
+	else if (expr->is<Expr::Unary>())
+	{
+		this->number(expr->as<Expr::Unary>().right, index, calls, conditional, values);
+	}
+	else if (expr->is<Expr::Logical>())
+	{
+		this->number(expr->as<Expr::Logical>().left, index, calls, conditional, values);
+		this->number(expr->as<Expr::Logical>().right, index, calls, true, values);
+	}
+	else if (expr->is<Expr::Select>())
+	{
+		this->number(expr->as<Expr::Select>().condition, index, calls, conditional, values);
+		this->number(expr->as<Expr::Select>().if_true, index, calls, conditional, values);
+		this->number(expr->as<Expr::Select>().if_false, index, calls, conditional, values);
+	}
+	else if (expr->is<Expr::DeviceLoad>())
+	{
+		this->number(expr->as<Expr::DeviceLoad>().device, index, calls, conditional, values);
+	}
+	else if (expr->is<Expr::Call>())
+	{
+		for (auto& arg : expr->as<Expr::Call>().arguments)
+		{
+			this->number(arg, index, calls, conditional, values);
+		}
+	}
+	// a read that might not have happened cannot be moved in front of the statement
+	if (!candidate || (device && conditional))
+	{
+		return -1;
+	}
+	values.push_back(Value{ key, { &expr }, index, reads, device, "", true });
+	return static_cast<int>(values.size()) - 1;
+}
+
+bool ValueNumbering::key_of(Expr& expr, std::string& key, std::unordered_set<std::string>& reads, bool& device) const
+{
+	if (expr.is<Expr::Literal>())
+	{
+		key = expr.as<Expr::Literal>().literal.literal.to_lexeme();
+		return true;
+	}
+	if (expr.is<Expr::Variable>())
+	{
+		key = expr.as<Expr::Variable>().name.lexeme;
+		reads.insert(key);
+		return true;
+	}
+	if (expr.is<Expr::Grouping>())
+	{
+		return this->key_of(*expr.as<Expr::Grouping>().expression, key, reads, device);
+	}
+	if (expr.is<Expr::Unary>())
+	{
+		Expr::Unary& unary = expr.as<Expr::Unary>();
+		std::string right;
+		if ((unary.op.type != TokenType::MINUS && unary.op.type != TokenType::BANG) || !this->key_of(*unary.right, right, reads, device))
+		{
+			return false;
+		}
+		key = "(" + unary.op.lexeme + " " + right + ")";
+		return true;
+	}
+	if (expr.is<Expr::Binary>())
+	{
+		Expr::Binary& binary = expr.as<Expr::Binary>();
+		std::string left;
+		std::string right;
+		if (!this->key_of(*binary.left, left, reads, device) || !this->key_of(*binary.right, right, reads, device))
+		{
+			return false;
+		}
+		switch (binary.op.type)
+		{
+		case TokenType::PLUS:
+		case TokenType::STAR:
+		case TokenType::EQUAL_EQUAL:
+		case TokenType::BANG_EQUAL:
+			if (right < left)
+			{
+				std::swap(left, right);
+			}
+			break;
+		default:
+			break;
+		}
+		key = "(" + binary.op.lexeme + " " + left + " " + right + ")";
+		return true;
+	}
+	if (expr.is<Expr::Logical>())
+	{
+		Expr::Logical& logical = expr.as<Expr::Logical>();
+		std::string left;
+		std::string right;
+		if (!this->key_of(*logical.left, left, reads, device) || !this->key_of(*logical.right, right, reads, device))
+		{
+			return false;
+		}
+		key = "(" + logical.op.lexeme + " " + left + " " + right + ")";
+		return true;
+	}
+	if (expr.is<Expr::Select>())
+	{
+		Expr::Select& select = expr.as<Expr::Select>();
+		std::string condition;
+		std::string if_true;
+		std::string if_false;
+		if (!this->key_of(*select.condition, condition, reads, device) || !this->key_of(*select.if_true, if_true, reads, device) ||
+			!this->key_of(*select.if_false, if_false, reads, device))
+		{
+			return false;
+		}
+		key = "(select " + condition + " " + if_true + " " + if_false + ")";
+		return true;
+	}
+	if (expr.is<Expr::DeviceLoad>())
+	{
+		Expr::DeviceLoad& load = expr.as<Expr::DeviceLoad>();
+		std::string target;
+		if (!this->key_of(*load.device, target, reads, device))
+		{
+			return false;
+		}
+		device = true;
+		key = "(dload " + target + " " + load.logic_type.lexeme + " " + load.operation_type.type_name() + ")";
+		return true;
+	}
+	return false;
+}
+
+void ValueNumbering::kill(std::vector<Value>& values, const std::string& name) const
+{
+	for (Value& value : values)
+	{
+		if (value.reads.count(name))
+		{
+			value.valid = false;
+		}
+	}
+}
+
+void ValueNumbering::kill_calls(std::vector<Value>& values) const
+{
+	for (Value& value : values)
+	{
+		if (value.device || std::any_of(value.reads.begin(), value.reads.end(), [this](const std::string& name) { return this->statics.count(name) > 0; }))
+		{
+			value.valid = false;
+		}
+	}
+}
+
+void ValueNumbering::kill_devices(std::vector<Value>& values)
+{
+	for (Value& value : values)
+	{
+		if (value.device)
+		{
+			value.valid = false;
+		}
+	}
+}
+
+void ValueNumbering::kill_all(std::vector<Value>& values)
+{
+	for (Value& value : values)
+	{
+		value.valid = false;
+	}
+}
+
+static int line_of(Expr& expr)
+{
+	if (expr.is<Expr::Binary>())
+	{
+		return expr.as<Expr::Binary>().op.line;
+	}
+	if (expr.is<Expr::Unary>())
+	{
+		return expr.as<Expr::Unary>().op.line;
+	}
+	if (expr.is<Expr::Logical>())
+	{
+		return expr.as<Expr::Logical>().op.line;
+	}
+	if (expr.is<Expr::Select>())
+	{
+		return expr.as<Expr::Select>().token.line;
+	}
+	if (expr.is<Expr::DeviceLoad>())
+	{
+		return expr.as<Expr::DeviceLoad>().logic_type.line;
+	}
+	return -1;
+}
+
+void ValueNumbering::reuse(std::vector<std::unique_ptr<Stmt>>& statements, std::vector<Value>& values)
+{
+	// new locals to declare in front of each statement
+	std::vector<std::vector<std::unique_ptr<Stmt>>> declarations(statements.size());
+	bool declared = false;
+	for (Value& value : values)
+	{
+		if (value.sites.size() < 2)
+		{
+			continue;
+		}
+		std::shared_ptr<Expr> first = *value.sites[0];
+		int line = line_of(*first);
+		std::string name = value.holder;
+		size_t site = 1;
+		if (name.empty())
+		{
+			name = this->compiler.fresh_name("v");
+			declarations[value.statement].push_back(std::make_unique<Stmt::Variable>(TypeName(true, *first->type.m_type_name), Token(line, TokenType::IDENTIFIER, name), first));
+			declared = true;
+			site = 0;
+		}
+		for (; site < value.sites.size(); site++)
+		{
+			std::shared_ptr<Expr::Variable> read = std::make_shared<Expr::Variable>(Token(line, TokenType::IDENTIFIER, name));
+			read->type = first->type;
+			*value.sites[site] = read;
+		}
+		this->compiler.info(std::string("Reused ") + first->to_string() + " on line " + std::to_string(line) + " " +
+			std::to_string(value.sites.size() - 1) + " times from " + name);
+		this->reused++;
+	}
+	if (!declared)
+	{
+		return;
+	}
+	std::vector<std::unique_ptr<Stmt>> numbered;
+	for (size_t i = 0; i < statements.size(); i++)
+	{
+		for (auto& declaration : declarations[i])
+		{
+			numbered.push_back(std::move(declaration));
+		}
+		numbered.push_back(std::move(statements[i]));
+	}
+	statements = std::move(numbered);
+}
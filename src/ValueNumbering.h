@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "AST.h"
+#include "TypeChecker.h"
+
+class Compiler;
+
+// Computes repeated pure expressions once.
+// Statements are numbered in runs that end at any branch, loop or asm. Within a run every arithmetic, comparison
+// and logic expression is keyed by what it computes, and a key seen twice is computed once into a new
+// constant local, or read from the variable that was initialized or assigned with it.
+// dload is numbered as well while nothing between the reads can change devices: dset, asm or a call.
+// Works on a checked program, which has to be checked again once anything was reused.
+class ValueNumbering : public Stmt::Visitor
+{
+public:
+	ValueNumbering(Compiler& compiler, TypeCheckedProgram& program);
+
+	// returns whether anything was reused
+	bool run();
+
+	virtual void* visitStmtBlock(Stmt::Block& stmt) override;
+	virtual void* visitStmtIf(Stmt::If& stmt) override;
+	virtual void* visitStmtFunction(Stmt::Function& stmt) override;
+	virtual void* visitStmtWhile(Stmt::While& stmt) override;
+private:
+	struct Value
+	{
+		std::string key;
+		// every place the value is computed, the first one stays
+		std::vector<std::shared_ptr<Expr>*> sites;
+		// the statement the first site is in
+		size_t statement;
+		std::unordered_set<std::string> reads;
+		bool device;
+		// the variable initialized or assigned with the first site, which can be read instead
+		std::string holder;
+		// cleared once something it reads may have changed
+		bool valid;
+	};
+
+	void process(std::vector<std::unique_ptr<Stmt>>& statements);
+	void number_statement(Stmt& stmt, size_t index, std::vector<Value>& values);
+	// returns the index of the value registered for the expression itself, or -1
+	int number(std::shared_ptr<Expr>& expr, size_t index, bool calls, bool conditional, std::vector<Value>& values);
+	void reuse(std::vector<std::unique_ptr<Stmt>>& statements, std::vector<Value>& values);
+
+	bool key_of(Expr& expr, std::string& key, std::unordered_set<std::string>& reads, bool& device) const;
+	void kill(std::vector<Value>& values, const std::string& name) const;
+	void kill_calls(std::vector<Value>& values) const;
+	static void kill_devices(std::vector<Value>& values);
+	static void kill_all(std::vector<Value>& values);
+
+	Compiler& compiler;
+	TypeCheckedProgram& program;
+	std::unordered_set<std::string> statics;
+	int reused;
+};